@@ -3,24 +3,69 @@
 
 #include <iostream>
 #include <future>
+#include <memory>
+#include <exception>
+#include <type_traits>
+#include <iterator>
 
 #include <string>
 
 #include <chrono>
 using namespace std::chrono;
-using clk = system_clock;
+// timers are relative, a monotonic clock is not moved by wall clock changes
+using clk = steady_clock;
 using namespace std::chrono_literals;
 
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+using namespace std;
+#else
 #include <experimental/resumable>
 #include <experimental/generator>
 using namespace std;
 using namespace std::experimental;
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// the demo coroutines return a task, get() waits until the body has
+// finished and rethrows what it threw
+struct task
+{
+    struct promise_type
+    {
+        promise<void> done;
+
+        task get_return_object() {
+            return task{ done.get_future() };
+        }
+        suspend_never initial_suspend() noexcept {
+            return{};
+        }
+        suspend_never final_suspend() noexcept {
+            return{};
+        }
+        void return_void() {
+            done.set_value();
+        }
+        void unhandled_exception() {
+            done.set_exception(current_exception());
+        }
+    };
 
-#define co_await __await
-#define co_yield __yield_value
+    void get() {
+        result.get();
+    }
 
-#include <windows.h>
-#include <threadpoolapiset.h>
+    future<void> result;
+};
 
 namespace rx {
 
@@ -40,35 +85,60 @@ struct async_generator
     {
         coroutine_handle<> _AwaitIteratorCoro;
         coroutine_handle<> _AwaitConsumerCoro;
-        const _Ty* _CurrentValue;
+        const _Ty* _CurrentValue = nullptr;
+        exception_ptr _Error;
 
-        promise_type& get_return_object()
+        // resumes the iterator awaiting the end once the frame is suspended
+        struct final_awaiter
         {
-            return *this;
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            coroutine_handle<> await_suspend(coroutine_handle<promise_type> _Coro) noexcept
+            {
+                auto _AwaitIteratorCoro = _Coro.promise()._AwaitIteratorCoro;
+                _Coro.promise()._AwaitIteratorCoro = nullptr;
+                if (_AwaitIteratorCoro) {
+                    return _AwaitIteratorCoro;
+                }
+                return noop_coroutine();
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        async_generator get_return_object()
+        {
+            return async_generator{ *this };
         }
 
-        suspend_always initial_suspend()
+        suspend_always initial_suspend() noexcept
         {
             return{};
         }
 
-        suspend_always final_suspend()
+        final_awaiter final_suspend() noexcept
         {
             return{};
         }
 
         await_consumer<_Ty, promise_type, _Alloc> yield_value(_Ty const & _Value)
         {
-            _CurrentValue = _STD addressof(_Value);
-            return{ coroutine_handle<promise_type>::from_promise(this) };
+            _CurrentValue = std::addressof(_Value);
+            return{ coroutine_handle<promise_type>::from_promise(*this) };
         }
 
         void return_void() {
-            auto _Coro = move(_AwaitIteratorCoro);
-            _AwaitIteratorCoro = nullptr;
-            if (_Coro) {
-                _Coro.resume();
-            }
+            _CurrentValue = nullptr;
+        }
+
+        void unhandled_exception() {
+            _CurrentValue = nullptr;
+            _Error = current_exception();
         }
 
         using _Alloc_traits = allocator_traits<_Alloc>;
@@ -80,7 +150,7 @@ struct async_generator
             return _Al.allocate(_Size);
         }
 
-        void operator delete(void* _Ptr, size_t _Size) _NOEXCEPT
+        void operator delete(void* _Ptr, size_t _Size) noexcept
         {
             _Alloc_of_char_type _Al;
             return _Al.deallocate(static_cast<char*>(_Ptr), _Size);
@@ -98,7 +168,7 @@ struct async_generator
     }
 
     explicit async_generator(promise_type& _Prom)
-        : _Coro(coroutine_handle<promise_type>::from_promise(_STD addressof(_Prom)))
+        : _Coro(coroutine_handle<promise_type>::from_promise(_Prom))
     {
     }
 
@@ -108,19 +178,24 @@ struct async_generator
 
     async_generator& operator = (async_generator const&) = delete;
 
-    async_generator(async_generator && _Right)
+    async_generator(async_generator && _Right) noexcept
         : _Coro(_Right._Coro)
     {
         _Right._Coro = nullptr;
     }
 
-    async_generator& operator = (async_generator && _Right)
+    async_generator& operator = (async_generator && _Right) noexcept
     {
         if (&_Right != this)
         {
+            if (_Coro)
+            {
+                _Coro.destroy();
+            }
             _Coro = _Right._Coro;
             _Right._Coro = nullptr;
         }
+        return *this;
     }
 
     ~async_generator()
@@ -170,33 +245,33 @@ struct await_consumer
     {
     }
 
-    bool await_ready() _NOEXCEPT
+    bool await_ready() noexcept
     {
         return false;
     }
 
-    void await_suspend(coroutine_handle<> _AwaitConsumerCoro) _NOEXCEPT
+    coroutine_handle<> await_suspend(coroutine_handle<> _AwaitConsumerCoro) noexcept
     {
         _GeneratorCoro.promise()._AwaitConsumerCoro = _AwaitConsumerCoro;
 
         auto _AwaitIteratorCoro = move(_GeneratorCoro.promise()._AwaitIteratorCoro);
         _GeneratorCoro.promise()._AwaitIteratorCoro = nullptr;
         if (_AwaitIteratorCoro) {
-            _AwaitIteratorCoro.resume();
+            return _AwaitIteratorCoro;
         }
+        return noop_coroutine();
     }
 
-    void await_resume() _NOEXCEPT
+    void await_resume() noexcept
     {
     }
 };
 
 template <typename _Ty, typename _GeneratorPromise, typename _Alloc >
-struct await_iterator 
+struct await_iterator
 {
     coroutine_handle<_GeneratorPromise> _GeneratorCoro;
     async_iterator<_Ty, _GeneratorPromise, _Alloc>* _It;
-    bool owner;
 
     await_iterator(coroutine_handle<_GeneratorPromise> _GCoro)
         : _GeneratorCoro(_GCoro)
@@ -211,7 +286,7 @@ struct await_iterator
     {
     }
 
-    await_iterator() 
+    await_iterator()
         : _GeneratorCoro()
         , _It(nullptr)
     {}
@@ -222,7 +297,7 @@ struct await_iterator
 
     await_iterator(await_iterator && _Right)
         : _GeneratorCoro(_Right._GeneratorCoro)
-        , _It(_OIt)
+        , _It(_Right._It)
     {
         _Right._GeneratorCoro = nullptr;
         _Right._It = nullptr;
@@ -245,12 +320,12 @@ struct await_iterator
     {
     }
 
-    bool await_ready() _NOEXCEPT
+    bool await_ready() noexcept
     {
         return false;
     }
 
-    void await_suspend(coroutine_handle<> _AwaitIteratorCoro) _NOEXCEPT
+    coroutine_handle<> await_suspend(coroutine_handle<> _AwaitIteratorCoro) noexcept
     {
         _GeneratorCoro.promise()._AwaitIteratorCoro = _AwaitIteratorCoro;
 
@@ -259,17 +334,17 @@ struct await_iterator
         if (_AwaitConsumerCoro) {
             // resume co_yield
             _GeneratorCoro.promise()._CurrentValue = nullptr;
-            _AwaitConsumerCoro.resume();
-        }
-        else {
-            // first resume
-            _GeneratorCoro.resume();
+            return _AwaitConsumerCoro;
         }
-
+        // first resume
+        return _GeneratorCoro;
     }
 
-    async_iterator<_Ty, _GeneratorPromise, _Alloc> await_resume() _NOEXCEPT
+    async_iterator<_Ty, _GeneratorPromise, _Alloc> await_resume()
     {
+        if (_GeneratorCoro.promise()._Error) {
+            rethrow_exception(_GeneratorCoro.promise()._Error);
+        }
         if (_GeneratorCoro.done() || !_GeneratorCoro.promise()._CurrentValue) {
             _GeneratorCoro = nullptr;
         }
@@ -283,8 +358,13 @@ struct await_iterator
 
 template <typename _Ty, typename _GeneratorPromise, typename _Alloc>
 struct async_iterator
-    : _STD iterator<input_iterator_tag, _Ty>
 {
+    using iterator_category = input_iterator_tag;
+    using value_type = _Ty;
+    using difference_type = ptrdiff_t;
+    using pointer = _Ty const*;
+    using reference = _Ty const&;
+
     coroutine_handle<_GeneratorPromise> _GeneratorCoro;
 
     async_iterator(nullptr_t)
@@ -331,47 +411,291 @@ struct async_iterator
 
     _Ty const* operator->() const
     {
-        return _STD addressof(operator*());
+        return std::addressof(operator*());
     }
 
 };
 
 }
 
-// usage: await resume_at(std::chrono::system_clock::now() + 1s);
-auto resume_at(clk::time_point at) {
+// the priority class and relative deadline of the resumptions of a
+// pipeline. higher priorities run first, within a priority the earliest
+// deadline runs first, the deadline of a resumption is the time it
+// became ready plus deadline.
+struct schedule
+{
+    int priority = 0;
+    clk::duration deadline = clk::duration::max();
+};
+
+// the schedule of the coroutine running on this thread. awaiters that
+// resume later capture it, so a resumption keeps its pipeline's schedule.
+inline schedule& current_schedule() {
+    thread_local schedule tag;
+    return tag;
+}
+
+// worker threads that resume ready coroutines in schedule order instead
+// of the order they became ready
+class executor {
+    struct ready_item
+    {
+        int priority;
+        clk::time_point deadline;
+        uint64_t seq;
+        schedule tag;
+        coroutine_handle<> resume_cb;
+    };
+
+    struct later
+    {
+        bool operator()(ready_item const& a, ready_item const& b) const {
+            if (a.priority != b.priority) {
+                return a.priority < b.priority;
+            }
+            if (a.deadline != b.deadline) {
+                return a.deadline > b.deadline;
+            }
+            return a.seq > b.seq;
+        }
+    };
+
+    mutex lock;
+    condition_variable wake;
+    priority_queue<ready_item, vector<ready_item>, later> ready;
+    uint64_t posted = 0;
+    bool stopping = false;
+    vector<thread> workers;
+
+    explicit executor(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            workers.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~executor() {
+        shutdown();
+    }
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [this]() { return stopping || !ready.empty(); });
+            if (ready.empty()) {
+                return;
+            }
+            auto item = ready.top();
+            ready.pop();
+            guard.unlock();
+            current_schedule() = item.tag;
+            item.resume_cb();
+            guard.lock();
+        }
+    }
+
+public:
+    static executor& instance() {
+        static executor e(std::max(1u, thread::hardware_concurrency()));
+        return e;
+    }
+
+    // resumes what is ready and joins the workers, a coroutine posted
+    // after that is not resumed. called at exit, once the pipelines are
+    // done. a worker that calls it finishes on its own.
+    void shutdown() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            if (w.get_id() == this_thread::get_id()) {
+                w.detach();
+            }
+            else if (w.joinable()) {
+                w.join();
+            }
+        }
+    }
+
+    void post(coroutine_handle<> resume_cb, schedule tag, clk::time_point ready_at) {
+        auto deadline = tag.deadline >= clk::time_point::max() - ready_at ? clk::time_point::max() : ready_at + tag.deadline;
+        {
+            lock_guard<mutex> guard(lock);
+            if (stopping) {
+                return;
+            }
+            ready.push(ready_item{ tag.priority, deadline, posted++, tag, resume_cb });
+        }
+        wake.notify_one();
+    }
+};
+
+// usage: co_await resume_on(schedule{ 1 });
+// continues the coroutine on the executor with the given schedule
+auto resume_on(schedule tag) {
     class awaiter {
-        static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE, void* Context, PTP_TIMER) {
-            coroutine_handle<>::from_address(Context)();
+        schedule tag;
+    public:
+        awaiter(schedule t)
+            : tag(t) {}
+        bool await_ready() const {
+            return false;
+        }
+        void await_suspend(coroutine_handle<> resume_cb) {
+            executor::instance().post(resume_cb, tag, clk::now());
+        }
+        void await_resume() {
         }
-        PTP_TIMER timer = nullptr;
+    };
+    return awaiter{ tag };
+}
+
+// counts of timers fired by the timer thread and of the times it woke
+// to fire them, a wakeup fires every timer that is due
+struct timer_counters
+{
+    uint64_t timers = 0;
+    uint64_t wakeups = 0;
+
+    uint64_t wakeups_saved() const {
+        return timers - wakeups;
+    }
+};
+
+// one thread waits for all timers and hands the due ones to the executor
+// with the schedule that was current when they were set. a timer with
+// slack may be resumed anywhere in [at, at + slack], its deadline is
+// rounded up to a multiple of the slack so that timers due close
+// together share a wakeup.
+class timer_queue {
+    struct timer
+    {
+        coroutine_handle<> resume_cb;
+        schedule tag;
+    };
+
+    mutex lock;
+    condition_variable wake;
+    multimap<clk::time_point, timer> due;
+    timer_counters counted;
+    bool stopping = false;
+    executor& ready_queue;
+    thread worker;
+
+    // the executor is created first, so it is destroyed after this
+    timer_queue()
+        : ready_queue(executor::instance())
+        , worker([this]() { run(); }) {}
+
+    ~timer_queue() {
+        shutdown();
+    }
+
+    void run() {
+        vector<pair<clk::time_point, timer>> ready;
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            if (stopping) {
+                return;
+            }
+            if (due.empty()) {
+                wake.wait(guard);
+                continue;
+            }
+            auto now = clk::now();
+            if (now < due.begin()->first) {
+                wake.wait_until(guard, due.begin()->first);
+                continue;
+            }
+            auto last = due.upper_bound(now);
+            for (auto it = due.begin(); it != last; ++it) {
+                ready.push_back(*it);
+            }
+            due.erase(due.begin(), last);
+            counted.timers += ready.size();
+            ++counted.wakeups;
+            guard.unlock();
+            for (auto& fired : ready) {
+                ready_queue.post(fired.second.resume_cb, fired.second.tag, fired.first);
+            }
+            ready.clear();
+            guard.lock();
+        }
+    }
+
+public:
+    static timer_queue& instance() {
+        static timer_queue queue;
+        return queue;
+    }
+
+    // joins the timer thread, the timers that are still due are dropped
+    // and their coroutines are not resumed
+    void shutdown() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.get_id() == this_thread::get_id()) {
+            worker.detach();
+        }
+        else if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    static clk::time_point coalesce(clk::time_point at, clk::duration slack) {
+        if (slack <= clk::duration::zero()) {
+            return at;
+        }
+        auto early = at.time_since_epoch() % slack;
+        return early == clk::duration::zero() ? at : at + (slack - early);
+    }
+
+    void add(clk::time_point at, coroutine_handle<> resume_cb, schedule tag) {
+        {
+            lock_guard<mutex> guard(lock);
+            auto first = due.empty() || at < due.begin()->first;
+            due.emplace(at, timer{ resume_cb, tag });
+            if (!first) {
+                return;
+            }
+        }
+        wake.notify_one();
+    }
+
+    timer_counters counters() {
+        lock_guard<mutex> guard(lock);
+        return counted;
+    }
+};
+
+// usage: co_await resume_at(std::chrono::steady_clock::now() + 1s);
+// usage: co_await resume_at(std::chrono::steady_clock::now() + 1s, 10ms);
+auto resume_at(clk::time_point at, clk::duration slack = clk::duration::zero()) {
+    class awaiter {
         clk::time_point at;
+        clk::duration slack;
     public:
-        awaiter(clk::time_point a)
-            : at(a) {}
+        awaiter(clk::time_point a, clk::duration s)
+            : at(a), slack(s) {}
         bool await_ready() const {
             return clk::now() >= at;
         }
         void await_suspend(coroutine_handle<> resume_cb) {
-            auto duration = at - clk::now();
-            int64_t relative_count = -duration.count();
-            timer = CreateThreadpoolTimer(TimerCallback, resume_cb.to_address(), nullptr);
-            if (timer == 0)
-                throw system_error(GetLastError(), system_category());
-            SetThreadpoolTimer(timer, (PFILETIME)&relative_count, 0, 0);
+            timer_queue::instance().add(timer_queue::coalesce(at, slack), resume_cb, current_schedule());
         }
         void await_resume() {
         }
-        ~awaiter() {
-            if (timer) CloseThreadpoolTimer(timer);
-        }
     };
-    return awaiter{ at };
+    return awaiter{ at, slack };
 }
 
-// usage: await resume_after(1s);
-auto resume_after(clk::duration period) {
-    return resume_at(clk::now() + period);
+// usage: co_await resume_after(1s);
+auto resume_after(clk::duration period, clk::duration slack = clk::duration::zero()) {
+    return resume_at(clk::now() + period, slack);
 }
 
 rx::async_generator<int> fibonacci(int n) {
@@ -391,8 +715,8 @@ struct adaptor
     mutable decay_t<Adaptor> a;
 
     template<class T, class Alloc>
-    auto operator()(rx::async_generator<T, Alloc> s) const -> 
-        result_of_t<decay_t<Adaptor>(rx::async_generator<T, Alloc>)> {
+    auto operator()(rx::async_generator<T, Alloc> s) const ->
+        invoke_result_t<decay_t<Adaptor>&, rx::async_generator<T, Alloc>> {
         return a(move(s));
     }
 };
@@ -402,24 +726,39 @@ auto make_adaptor(Adaptor&& a) -> adaptor<decay_t<Adaptor>> {
     return{ forward<Adaptor>(a) };
 }
 
+// the loops below are the expansion of the msvc only
+// for co_await(auto i : s) range statement
 namespace detail {
 
     struct delay
     {
         clk::duration period;
+        clk::duration slack;
 
+        // the coroutine takes its state by value, the adaptor is a
+        // temporary that is gone before the first value is produced
         template<class T, class Alloc>
-        auto operator()(rx::async_generator<T, Alloc> s) const -> rx::async_generator<T, Alloc> {
-            for co_await(auto i : s) {
-                co_await resume_after(period);
+        static auto run(rx::async_generator<T, Alloc> s, clk::duration period, clk::duration slack) -> rx::async_generator<T, Alloc> {
+            auto it = co_await s.begin();
+            while (it != s.end()) {
+                auto i = *it;
+                co_await resume_after(period, slack);
                 co_yield i;
+                co_await ++it;
             }
         }
+
+        template<class T, class Alloc>
+        auto operator()(rx::async_generator<T, Alloc> s) const -> rx::async_generator<T, Alloc> {
+            return run(move(s), period, slack);
+        }
     };
 }
 
-auto delay(clk::duration p) -> adaptor<detail::delay> {
-    return make_adaptor(detail::delay{ p });
+// slack lets the timers of the pipeline be resumed up to slack late,
+// so that they share wakeups with other timers
+auto delay(clk::duration p, clk::duration slack = clk::duration::zero()) -> adaptor<detail::delay> {
+    return make_adaptor(detail::delay{ p, slack });
 }
 
 namespace detail {
@@ -430,14 +769,90 @@ namespace detail {
         mutable decay_t<Pred> pred;
 
         template<class T, class Alloc>
-        auto operator()(rx::async_generator<T, Alloc> s) const -> rx::async_generator<T, Alloc> {
-            for co_await(auto i : s) {
+        static auto run(rx::async_generator<T, Alloc> s, decay_t<Pred> pred) -> rx::async_generator<T, Alloc> {
+            auto it = co_await s.begin();
+            while (it != s.end()) {
+                auto i = *it;
                 if (pred(i)) co_yield i;
+                co_await ++it;
+            }
+        }
+
+        template<class T, class Alloc>
+        auto operator()(rx::async_generator<T, Alloc> s) const -> rx::async_generator<T, Alloc> {
+            return run(move(s), pred);
+        }
+    };
+}
+
+namespace detail {
+
+    // hops through the executor when the source is started. a pull runs
+    // on the consumer's thread with the schedule made current, so the
+    // resumptions it leads to carry it, and every batch pulls it hops
+    // again so that work of a higher priority gets a turn.
+    struct scheduled
+    {
+        schedule tag;
+        size_t batch;
+
+        // makes the schedule current when the source is resumed and puts
+        // the consumer's back when the consumer is resumed. the consumer's
+        // schedule is kept here, not on the thread, because the pull can
+        // suspend and the consumer be resumed on another worker. a thread
+        // the pull suspends on is not left with the schedule, every
+        // resumption there comes through the executor and installs its own.
+        template<class Pull>
+        struct pull_awaiter
+        {
+            Pull pull;
+            schedule tag;
+            schedule outer;
+
+            bool await_ready() noexcept {
+                return pull.await_ready();
+            }
+            coroutine_handle<> await_suspend(coroutine_handle<> resume_cb) noexcept {
+                outer = exchange(current_schedule(), tag);
+                return pull.await_suspend(resume_cb);
+            }
+            void await_resume() {
+                current_schedule() = outer;
+                pull.await_resume();
+            }
+        };
+
+        template<class T, class Alloc>
+        static auto run(rx::async_generator<T, Alloc> s, schedule tag, size_t batch) -> rx::async_generator<T, Alloc> {
+            co_await resume_on(tag);
+            auto it = co_await s.begin();
+            size_t pulled = 0;
+            while (it != s.end()) {
+                co_yield *it;
+                if (batch != 0 && ++pulled % batch == 0) {
+                    co_await resume_on(tag);
+                }
+                co_await pull_awaiter<decltype(++it)>{ ++it, tag, schedule{} };
             }
         }
+
+        template<class T, class Alloc>
+        auto operator()(rx::async_generator<T, Alloc> s) const -> rx::async_generator<T, Alloc> {
+            return run(move(s), tag, batch);
+        }
     };
 }
 
+// batch is the number of values pulled between hops through the
+// executor, 0 hops only when the source is started
+auto with_priority(int p, clk::duration deadline = clk::duration::max(), size_t batch = 64) -> adaptor<detail::scheduled> {
+    return make_adaptor(detail::scheduled{ schedule{ p, deadline }, batch });
+}
+
+auto with_deadline(clk::duration deadline, int p = 0, size_t batch = 64) -> adaptor<detail::scheduled> {
+    return make_adaptor(detail::scheduled{ schedule{ p, deadline }, batch });
+}
+
 template<class Pred>
 auto copy_if(Pred&& p) -> adaptor<detail::copy_if<Pred>> {
     return make_adaptor(detail::copy_if<Pred>{forward<Pred>(p)});
@@ -451,12 +866,21 @@ namespace detail {
         mutable decay_t<Transform> t;
 
         template<class T, class Alloc>
-        auto operator()(rx::async_generator<T, Alloc> s) const -> 
-            rx::async_generator<result_of_t<decay_t<Transform>(T)>, Alloc> {
-            for co_await(auto v : s) {
+        static auto run(rx::async_generator<T, Alloc> s, decay_t<Transform> t) ->
+            rx::async_generator<invoke_result_t<decay_t<Transform>&, T>, Alloc> {
+            auto it = co_await s.begin();
+            while (it != s.end()) {
+                auto v = *it;
                 co_yield t(v);
+                co_await ++it;
             }
         }
+
+        template<class T, class Alloc>
+        auto operator()(rx::async_generator<T, Alloc> s) const ->
+            rx::async_generator<invoke_result_t<decay_t<Transform>&, T>, Alloc> {
+            return run(move(s), t);
+        }
     };
 }
 
@@ -466,21 +890,23 @@ auto transform(Pred&& p) -> adaptor<detail::transform<Pred>> {
 }
 
 template<class T, class Alloc, class Adaptor>
-auto operator|(rx::async_generator<T, Alloc> s, adaptor<Adaptor> adapt) -> 
-    result_of_t<decay_t<Adaptor>(rx::async_generator<T, Alloc>)> {
+auto operator|(rx::async_generator<T, Alloc> s, adaptor<Adaptor> adapt) ->
+    invoke_result_t<decay_t<Adaptor>&, rx::async_generator<T, Alloc>> {
     return adapt(move(s));
 }
 
-future<void> waitfor() {
-    for co_await(auto v : fibonacci(10) | 
+task waitfor() {
+    auto s = fibonacci(10) |
         copy_if([](int v) {return v % 2 != 0; }) |
-        transform([](int i) {return to_string(i) + ","; }) | 
-        delay(1s)
-    ) {
-        std::cout << v << ' ';
+        transform([](int i) {return to_string(i) + ","; }) |
+        delay(1s);
+    auto it = co_await s.begin();
+    while (it != s.end()) {
+        std::cout << *it << ' ';
+        co_await ++it;
     }
 }
 
-int wmain() {
+int main() {
     waitfor().get();
 }
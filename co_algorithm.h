@@ -1,7 +1,58 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#else
+#include <experimental/coroutine>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CO_ALG_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define CO_ALG_TSC 1
+#endif
+
 namespace co_alg {
 
+#if defined(__cpp_impl_coroutine)
+	using std::coroutine_handle;
+	using std::noop_coroutine;
+	using std::suspend_always;
+	using std::suspend_never;
+#else
+	using std::experimental::coroutine_handle;
+	using std::experimental::noop_coroutine;
+	using std::experimental::suspend_always;
+	using std::experimental::suspend_never;
+#endif
+
 	// extension point for switching from exceptions to error codes
 
 	template<typename T>
@@ -26,14 +77,580 @@ namespace co_alg {
 		}
 	};
 
+	// extension point for the bytes a buffered value is charged against a budget
+
+	template<typename T>
+	struct co_size_of
+	{
+		std::size_t operator()(T const &) const {
+			return sizeof(T);
+		}
+	};
+
+	// a monotonic clock read from the time stamp counter, for measuring
+	// intervals. it reads steady_clock until calibrate() has measured the
+	// counter rate against steady_clock, call it once at startup, off the
+	// hot path. time points start on steady_clock's epoch but drift from it
+	// by the error of the measured rate, a few parts per million after the
+	// default window or tens of milliseconds an hour, so to_steady() is
+	// only close to steady_clock::now() near the calibration. without an
+	// invariant counter, which a hypervisor may hide, or off x86, now()
+	// keeps reading steady_clock.
+	struct co_tsc_clock
+	{
+		using rep = std::int64_t;
+		using period = std::nano;
+		using duration = std::chrono::nanoseconds;
+		using time_point = std::chrono::time_point<co_tsc_clock>;
+		static constexpr bool is_steady = true;
+
+		static time_point now() noexcept {
+#if defined(CO_ALG_TSC)
+			auto& c = calibration::get();
+			if (c.ready.load(std::memory_order_acquire)) {
+				auto ticks = static_cast<std::int64_t>(__rdtsc() - c.base_ticks);
+				return time_point(duration(c.base + static_cast<rep>(static_cast<double>(ticks) * c.ns_per_tick)));
+			}
+#endif
+			return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()));
+		}
+
+		// busy waits for window while it measures the counter rate, a longer
+		// window gives a smaller rate error. only the first call measures.
+		// returns counter().
+		static bool calibrate(std::chrono::milliseconds window = std::chrono::milliseconds(200)) noexcept {
+#if defined(CO_ALG_TSC)
+			auto& c = calibration::get();
+			if (!c.started.exchange(true)) {
+				c.measure(window);
+			}
+			else {
+				while (!c.done.load(std::memory_order_acquire)) {
+				}
+			}
+#else
+			(void)window;
+#endif
+			return counter();
+		}
+
+		// true when now() reads the counter
+		static bool counter() noexcept {
+#if defined(CO_ALG_TSC)
+			return calibration::get().ready.load(std::memory_order_acquire);
+#else
+			return false;
+#endif
+		}
+
+		static std::chrono::steady_clock::time_point to_steady(time_point t) noexcept {
+			return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(t.time_since_epoch()));
+		}
+
+	private:
+#if defined(CO_ALG_TSC)
+		struct calibration
+		{
+			static calibration& get() noexcept {
+				static calibration c;
+				return c;
+			}
+
+			void measure(std::chrono::milliseconds window) noexcept {
+				if (invariant()) {
+					using steady = std::chrono::steady_clock;
+					// each end reads the counter on both sides of steady_clock
+					// and takes the middle, which halves the read skew
+					auto sample = [](steady::time_point& s) {
+						auto before = __rdtsc();
+						s = steady::now();
+						return before + (__rdtsc() - before) / 2;
+					};
+					steady::time_point s0, s1;
+					auto t0 = sample(s0);
+					auto t1 = t0;
+					do {
+						t1 = sample(s1);
+					} while (s1 - s0 < window);
+					if (t1 > t0) {
+						ns_per_tick = static_cast<double>(std::chrono::duration_cast<duration>(s1 - s0).count()) / static_cast<double>(t1 - t0);
+						base = std::chrono::duration_cast<duration>(s1.time_since_epoch()).count();
+						base_ticks = t1;
+						ready.store(true, std::memory_order_release);
+					}
+				}
+				done.store(true, std::memory_order_release);
+			}
+
+			// cpuid 0x80000007 edx bit 8, the counter runs at a constant
+			// rate in every power state
+			static bool invariant() noexcept {
+#if defined(_MSC_VER)
+				int r[4];
+				__cpuid(r, static_cast<int>(0x80000000));
+				if (static_cast<unsigned>(r[0]) < 0x80000007) {
+					return false;
+				}
+				__cpuid(r, static_cast<int>(0x80000007));
+				return (r[3] & (1 << 8)) != 0;
+#else
+				unsigned a, b, c, d;
+				if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007) {
+					return false;
+				}
+				__get_cpuid(0x80000007, &a, &b, &c, &d);
+				return (d & (1u << 8)) != 0;
+#endif
+			}
+
+			// written once by measure before ready is set
+			double ns_per_tick = 0;
+			rep base = 0;
+			std::uint64_t base_ticks = 0;
+			std::atomic<bool> started{false};
+			std::atomic<bool> done{false};
+			std::atomic<bool> ready{false};
+		};
+#endif
+	};
+
+	// frame accounting is compiled in when CO_ALG_FRAME_BUDGET is defined
+	// before this header is included. without it co_frame_allocation is
+	// empty and a frame is allocated with a plain operator new, with no
+	// header and no thread local lookup.
+#if defined(CO_ALG_FRAME_BUDGET)
+
+	struct co_frame_stats
+	{
+		// frames and bytes allocated, a frame's bytes include its header
+		std::size_t frames = 0;
+		std::size_t bytes = 0;
+		// frames and bytes not yet freed
+		std::size_t live_frames = 0;
+		std::size_t live_bytes = 0;
+		std::size_t peak_bytes = 0;
+	};
+
+	class co_frame_budget_exceeded : public std::bad_alloc
+	{
+	public:
+		const char* what() const noexcept override {
+			return "co_alg: coroutine frame budget exceeded";
+		}
+	};
+
+	// the coroutine frames of a pipeline, capped at limit live bytes. a
+	// frame that does not fit is not allocated and the call that creates it
+	// throws co_frame_budget_exceeded, so building a pipeline over budget
+	// fails before it runs. with record set the size of each frame is kept
+	// in allocation order. a pipeline built with | allocates the frame of
+	// each operator as it is applied, from the source to the consumer, and
+	// operators like merge and take_until allocate more once started.
+	// recording is meant for a budget used on one thread at a time.
+	class co_frame_budget : public std::enable_shared_from_this<co_frame_budget>
+	{
+	public:
+		static std::shared_ptr<co_frame_budget> make(std::size_t limit = SIZE_MAX, bool record = false) {
+			return std::shared_ptr<co_frame_budget>(new co_frame_budget(limit, record));
+		}
+
+		co_frame_stats stats() const {
+			co_frame_stats s;
+			s.frames = frames.load(std::memory_order_relaxed);
+			s.bytes = bytes.load(std::memory_order_relaxed);
+			s.live_frames = live_frames.load(std::memory_order_relaxed);
+			s.live_bytes = live_bytes.load(std::memory_order_relaxed);
+			s.peak_bytes = peak_bytes.load(std::memory_order_relaxed);
+			return s;
+		}
+
+		std::vector<std::size_t> const & sizes() const {
+			return recorded;
+		}
+
+		std::size_t limit() const {
+			return cap;
+		}
+
+		bool charge(std::size_t size) {
+			auto live = live_bytes.load(std::memory_order_relaxed);
+			do {
+				if (size > cap || live > cap - size) {
+					return false;
+				}
+			} while (!live_bytes.compare_exchange_weak(live, live + size, std::memory_order_relaxed));
+			live += size;
+			auto peak = peak_bytes.load(std::memory_order_relaxed);
+			while (peak < live && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+			}
+			frames.fetch_add(1, std::memory_order_relaxed);
+			bytes.fetch_add(size, std::memory_order_relaxed);
+			live_frames.fetch_add(1, std::memory_order_relaxed);
+			if (record) {
+				recorded.push_back(size);
+			}
+			return true;
+		}
+
+		void credit(std::size_t size) {
+			live_bytes.fetch_sub(size, std::memory_order_relaxed);
+			live_frames.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+	private:
+		co_frame_budget(std::size_t limit, bool r) : cap(limit), record(r) {}
+
+		std::size_t cap;
+		bool record;
+		std::vector<std::size_t> recorded;
+		std::atomic<std::size_t> frames{0};
+		std::atomic<std::size_t> bytes{0};
+		std::atomic<std::size_t> live_frames{0};
+		std::atomic<std::size_t> live_bytes{0};
+		std::atomic<std::size_t> peak_bytes{0};
+	};
+
+	// charges the frames allocated on this thread, while the scope is
+	// active, to budget. a pipeline is charged for what it allocates while
+	// it runs by holding a scope around the code that drives it.
+	class co_frame_scope
+	{
+	public:
+		explicit co_frame_scope(std::shared_ptr<co_frame_budget> b) :
+			budget(std::move(b)),
+			previous(std::exchange(current(), std::addressof(budget)))
+		{}
+		co_frame_scope(const co_frame_scope&) = delete;
+		co_frame_scope& operator=(const co_frame_scope&) = delete;
+		~co_frame_scope() {
+			current() = previous;
+		}
+
+		static std::shared_ptr<co_frame_budget> const * active() noexcept {
+			return current();
+		}
+
+	private:
+		static std::shared_ptr<co_frame_budget> const *& current() noexcept {
+			thread_local std::shared_ptr<co_frame_budget> const * scope = nullptr;
+			return scope;
+		}
+
+		std::shared_ptr<co_frame_budget> budget;
+		std::shared_ptr<co_frame_budget> const * previous;
+	};
+
+	// the allocation of every coroutine frame in co_alg. each frame is
+	// preceded by a header that holds the budget it was charged to, if any,
+	// so the frame is credited back wherever it is destroyed.
+	struct co_frame_allocation
+	{
+		using header_type = std::shared_ptr<co_frame_budget>;
+
+		static constexpr std::size_t header = (sizeof(header_type) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+		static void* operator new(std::size_t size) {
+			auto total = size + header;
+			auto scope = co_frame_scope::active();
+			header_type budget = scope ? *scope : nullptr;
+			if (budget && !budget->charge(total)) {
+				throw co_frame_budget_exceeded();
+			}
+			void* raw = nullptr;
+			try
+			{
+				raw = ::operator new(total);
+			}
+			catch (...)
+			{
+				if (budget) {
+					budget->credit(total);
+				}
+				throw;
+			}
+			::new (raw) header_type(std::move(budget));
+			return static_cast<char*>(raw) + header;
+		}
+
+		static void operator delete(void* p, std::size_t size) noexcept {
+			auto raw = static_cast<char*>(p) - header;
+			auto budget = reinterpret_cast<header_type*>(raw);
+			if (*budget) {
+				(*budget)->credit(size + header);
+			}
+			budget->~header_type();
+			::operator delete(raw);
+		}
+	};
+
+#else
+
+	struct co_frame_allocation
+	{
+	};
+
+#endif
+
+	// counts non-negative values with a bounded relative error, in the
+	// manner of hdr histograms. values below 2^bits are counted exactly,
+	// above that each power of two is split into 2^(bits-1) buckets, so a
+	// value is reported at most 1 / 2^(bits-1) above what was recorded.
+	class co_hdr_histogram
+	{
+	public:
+		explicit co_hdr_histogram(unsigned bits = 7) :
+			bits(std::min(std::max(bits, 2u), 16u)),
+			counts(bucket(UINT64_MAX) + 1)
+		{}
+
+		void record(std::uint64_t v) {
+			++counts[bucket(v)];
+			++total;
+			lowest = std::min(lowest, v);
+			highest = std::max(highest, v);
+		}
+
+		std::uint64_t count() const {
+			return total;
+		}
+		std::uint64_t min() const {
+			return total == 0 ? 0 : lowest;
+		}
+		std::uint64_t max() const {
+			return highest;
+		}
+
+		// the value at or below which q of the recorded values fall
+		std::uint64_t percentile(double q) const {
+			if (total == 0) {
+				return 0;
+			}
+			auto rank = static_cast<std::uint64_t>(std::max(0.0, std::min(q, 1.0)) * static_cast<double>(total));
+			rank = std::max<std::uint64_t>(rank, 1);
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < counts.size(); ++i) {
+				seen += counts[i];
+				if (seen >= rank) {
+					return std::min(highest_in(i), highest);
+				}
+			}
+			return highest;
+		}
+
+		void reset() {
+			std::fill(counts.begin(), counts.end(), 0);
+			total = 0;
+			lowest = UINT64_MAX;
+			highest = 0;
+		}
+
+	private:
+		std::size_t bucket(std::uint64_t v) const {
+			std::uint64_t sub = std::uint64_t(1) << bits;
+			if (v < sub) {
+				return static_cast<std::size_t>(v);
+			}
+			std::uint64_t half = sub >> 1;
+			unsigned shift = 63 - static_cast<unsigned>(std::countl_zero(v)) - (bits - 1);
+			return static_cast<std::size_t>(sub + (shift - 1) * half + ((v >> shift) - half));
+		}
+
+		std::uint64_t highest_in(std::size_t i) const {
+			std::uint64_t sub = std::uint64_t(1) << bits;
+			if (i < sub) {
+				return i;
+			}
+			std::uint64_t half = sub >> 1;
+			auto k = i - sub;
+			auto shift = k / half + 1;
+			auto top = half + k % half;
+			return (top << shift) + ((std::uint64_t(1) << shift) - 1);
+		}
+
+		unsigned bits;
+		std::vector<std::uint64_t> counts;
+		std::uint64_t total = 0;
+		std::uint64_t lowest = UINT64_MAX;
+		std::uint64_t highest = 0;
+	};
+
+	// latency tracing is compiled in when CO_ALG_TRACE is defined before
+	// this header is included. without it co_trace_hop() is empty and a
+	// yield does not look up the trace context.
+#if defined(CO_ALG_TRACE)
+
+	class co_trace;
+
+	// rides with a sampled value from trace_source to trace_sink. it is
+	// current on the thread while the value moves down a chain of
+	// generators, each yield records a hop, the time since the previous
+	// one. merge carries the context of a value that waits in its pending
+	// queue and records the wait as a hop when the value is handed on.
+	struct co_trace_context
+	{
+		static constexpr std::size_t max_hops = 32;
+
+		void hop() {
+			if (skip != 0) {
+				--skip;
+				return;
+			}
+			auto now = co_tsc_clock::now();
+			auto span = (now - last).count();
+			last = now;
+			if (hops < max_hops) {
+				spans[hops++] = span;
+			}
+			else {
+				// later hops are folded into the last one
+				spans[max_hops - 1] += span;
+			}
+		}
+
+		static co_trace_context*& current() noexcept {
+			thread_local co_trace_context* context = nullptr;
+			return context;
+		}
+
+		co_trace* trace = nullptr;
+		// changes each time the context is reused
+		std::uint64_t id = 0;
+		bool active = false;
+		std::size_t skip = 0;
+		std::size_t hops = 0;
+		co_tsc_clock::time_point start;
+		co_tsc_clock::time_point last;
+		std::int64_t spans[max_hops] = {};
+	};
+
+	inline void co_trace_hop() {
+		if (auto c = co_trace_context::current()) {
+			c->hop();
+		}
+	}
+
+	// the sampled latencies of one pipeline. one value in every is traced,
+	// latency() holds the time from trace_source to trace_sink and hop(i)
+	// the time spent in the i-th hop. a trace is not synchronized, samples
+	// must complete on one thread at a time. a sample follows its value
+	// through co_alg generators and merge only. a value that zip, concat
+	// with prefetch, on_backpressure, replay, group_by or partition
+	// buffers, or that passes through an rx::async_generator, leaves its
+	// context behind and the sample is counted as lost.
+	class co_trace
+	{
+	public:
+		explicit co_trace(std::size_t every = 1024, unsigned bits = 7) :
+			every(every),
+			bits(bits),
+			end_to_end(bits)
+		{}
+
+		co_trace(const co_trace&) = delete;
+		co_trace& operator=(const co_trace&) = delete;
+
+		bool sample() {
+			if (every == 0 || ++seen < every) {
+				return false;
+			}
+			seen = 0;
+			return true;
+		}
+
+		co_trace_context* start() {
+			co_trace_context* c;
+			if (idle.empty()) {
+				contexts.push_back(std::make_unique<co_trace_context>());
+				c = contexts.back().get();
+			}
+			else {
+				c = idle.back();
+				idle.pop_back();
+			}
+			c->trace = this;
+			c->active = true;
+			// the yield of trace_source itself
+			c->skip = 1;
+			c->hops = 0;
+			c->start = c->last = co_tsc_clock::now();
+			++started;
+			return c;
+		}
+
+		void finish(co_trace_context* c) {
+			c->hop();
+			end_to_end.record(static_cast<std::uint64_t>(std::max<std::int64_t>((c->last - c->start).count(), 0)));
+			while (per_hop.size() < c->hops) {
+				per_hop.emplace_back(bits);
+			}
+			for (std::size_t i = 0; i < c->hops; ++i) {
+				per_hop[i].record(static_cast<std::uint64_t>(std::max<std::int64_t>(c->spans[i], 0)));
+			}
+			++completed;
+			release(c);
+		}
+
+		void abandon(co_trace_context* c) {
+			++abandoned;
+			release(c);
+		}
+
+		co_hdr_histogram const & latency() const {
+			return end_to_end;
+		}
+		std::size_t hop_count() const {
+			return per_hop.size();
+		}
+		co_hdr_histogram const & hop(std::size_t i) const {
+			return per_hop[i];
+		}
+		std::size_t sampled() const {
+			return started;
+		}
+		std::size_t complete() const {
+			return completed;
+		}
+		std::size_t lost() const {
+			return abandoned;
+		}
+
+	private:
+		void release(co_trace_context* c) {
+			c->active = false;
+			++c->id;
+			idle.push_back(c);
+		}
+
+		std::size_t every;
+		unsigned bits;
+		std::size_t seen = 0;
+		std::size_t started = 0;
+		std::size_t completed = 0;
+		std::size_t abandoned = 0;
+		co_hdr_histogram end_to_end;
+		std::vector<co_hdr_histogram> per_hop;
+		// contexts live as long as the trace so a stale pointer is never dangling
+		std::vector<std::unique_ptr<co_trace_context>> contexts;
+		std::vector<co_trace_context*> idle;
+	};
+
+#else
+
+	inline void co_trace_hop() {
+	}
+
+#endif
+
 	template<typename T>
-	struct co_generator_promise
+	struct co_generator_promise : co_frame_allocation
 	{
 		using value_type = T;
 
 		mutable value_type* value = nullptr;
-		mutable std::experimental::coroutine_handle<> caller{};
-		mutable std::experimental::coroutine_handle<> yielder{};
+		mutable coroutine_handle<> caller{};
+		mutable coroutine_handle<> yielder{};
+		// set when the body has finished, an advance after this produces the end iterator
+		mutable bool done = false;
 		co_exception<T> error;
 	};
 
@@ -51,7 +668,11 @@ namespace co_alg {
 			return false;
 		}
 
-		void await_suspend(const std::experimental::coroutine_handle<>& handle) {
+		coroutine_handle<> await_suspend(coroutine_handle<> handle) {
+			if (m_it->m_p->done) {
+				m_it->m_p->value = nullptr;
+				return handle;
+			}
 			if (!!m_it->m_p->caller) {
 				std::terminate();
 			}
@@ -62,7 +683,7 @@ namespace co_alg {
 				std::terminate();
 			}
 			m_it->m_p->value = nullptr;
-			yielder();
+			return yielder;
 		}
 
 		co_iterator<T>& await_resume() {
@@ -78,10 +699,16 @@ namespace co_alg {
 	};
 
 	template <typename T>
-	struct co_iterator : std::iterator<std::input_iterator_tag, T>
+	struct co_iterator
 	{
+		using iterator_category = std::input_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T*;
+		using reference = T&;
+
 		// end iterator
-		co_iterator(nullptr_t) : m_p(nullptr)
+		co_iterator(std::nullptr_t) : m_p(nullptr)
 		{
 		}
 
@@ -143,7 +770,11 @@ namespace co_alg {
 			return false;
 		}
 
-		void await_suspend(const std::experimental::coroutine_handle<>& handle) {
+		coroutine_handle<> await_suspend(coroutine_handle<> handle) {
+			if (m_p->done) {
+				m_p->value = nullptr;
+				return handle;
+			}
 			if (!!m_p->caller) {
 				std::terminate();
 			}
@@ -154,7 +785,7 @@ namespace co_alg {
 				std::terminate();
 			}
 			m_p->value = nullptr;
-			yielder();
+			return yielder;
 		}
 
 		co_iterator<T> await_resume() {
@@ -169,6 +800,9 @@ namespace co_alg {
 		co_generator_promise<T> const * m_p;
 	};
 
+	// owns the coroutine frame of the promise. the frame is destroyed with
+	// the generator, so a pipeline built and drained within one scope has a
+	// frame lifetime the compiler can see and elide the allocation for.
 	template <typename P>
 	struct co_generator
 	{
@@ -179,22 +813,25 @@ namespace co_alg {
 		co_generator(promise_type const & p) : p(std::addressof(p)) {};
 
 		co_generator() noexcept = default;
-		co_generator(const co_generator &) = default;
-		co_generator & operator=(const co_generator &) = default;
-		co_generator(co_generator && o) : p(o.p) {
+		co_generator(const co_generator &) = delete;
+		co_generator & operator=(const co_generator &) = delete;
+		co_generator(co_generator && o) noexcept : p(o.p) {
 			o.p = nullptr;
 		}
-		co_generator & operator=(co_generator && o) {
-			p = o.p;
-			o.p = nullptr;
+		co_generator & operator=(co_generator && o) noexcept {
+			if (this != std::addressof(o)) {
+				this->~co_generator();
+				p = o.p;
+				o.p = nullptr;
+			}
 			return *this;
 		}
 
 		~co_generator() noexcept {
-			//if (!!p) {
-			//	p->destroy();
-			//	p = nullptr;
-			//}
+			if (!!p) {
+				p->destroy();
+				p = nullptr;
+			}
 		}
 
 		co_iterator_awaiter<value_type> begin() const {
@@ -205,24 +842,29 @@ namespace co_alg {
 			return co_iterator<value_type>(nullptr);
 		}
 
+		// gives up ownership of the frame
+		promise_type const * release() noexcept {
+			return std::exchange(p, nullptr);
+		}
+
 	private:
-		promise_type const * p;
+		promise_type const * p = nullptr;
 	};
 
 	struct co_caller_awaiter
 	{
 		co_caller_awaiter(
-			std::experimental::coroutine_handle<>& caller,
-			std::experimental::coroutine_handle<>& yielder) :
+			coroutine_handle<>& caller,
+			coroutine_handle<>& yielder) :
 			m_caller(std::addressof(caller)),
 			m_yielder(std::addressof(yielder))
 		{}
 
-		bool await_ready() {
+		bool await_ready() noexcept {
 			return false;
 		}
 
-		void await_suspend(const std::experimental::coroutine_handle<>& handle) {
+		coroutine_handle<> await_suspend(coroutine_handle<> handle) noexcept {
 			if (!!*m_yielder) {
 				std::terminate();
 			}
@@ -230,15 +872,16 @@ namespace co_alg {
 			auto caller = *m_caller;
 			*m_caller = nullptr;
 			if (!!caller) {
-				caller();
+				return caller;
 			}
+			return noop_coroutine();
 		}
 
-		void await_resume() {
+		void await_resume() noexcept {
 		}
 
-		std::experimental::coroutine_handle<>* m_caller;
-		std::experimental::coroutine_handle<>* m_yielder;
+		coroutine_handle<>* m_caller;
+		coroutine_handle<>* m_yielder;
 	};
 
 	template<typename Promise>
@@ -250,9 +893,10 @@ namespace co_alg {
 			return false;
 		}
 
-		void await_suspend(const std::experimental::coroutine_handle<promise_type>& handle) {
+		bool await_suspend(coroutine_handle<promise_type> handle) {
 			p = std::addressof(handle.promise());
-			handle();
+			// continue without suspending
+			return false;
 		}
 
 		const promise_type& await_resume() {
@@ -262,98 +906,670 @@ namespace co_alg {
 		const promise_type* p;
 	};
 
-	template<typename Bind>
-	struct co_operator
+	// a coroutine that starts immediately and is never awaited.
+	// the frame is freed when the body completes. exceptions are dropped.
+	struct co_detached
 	{
-		Bind bind;
+		struct promise_type : co_frame_allocation
+		{
+			co_detached get_return_object() const noexcept {
+				return co_detached{};
+			}
+			suspend_never initial_suspend() const noexcept {
+				return suspend_never{};
+			}
+			suspend_never final_suspend() const noexcept {
+				return suspend_never{};
+			}
+			void return_void() const noexcept {
+			}
+			void unhandled_exception() const noexcept {
+			}
+		};
 	};
 
-	template<typename Bind>
-	co_operator<Bind> make_operator(Bind bind) {
-		return co_operator<Bind>{bind};
-	}
+	template<typename T>
+	struct co_task_promise;
 
+	// a coroutine that produces one T when it is awaited. the body starts
+	// when the task is awaited and resumes the awaiting coroutine when it
+	// completes, both by symmetric transfer.
 	template<typename T>
-	struct yield_value_promise : co_generator_promise<T>
+	struct co_task
 	{
-		std::future<void> emit_error() const {
-			value = error.yield();
-			if (value) {
-				co_await co_caller_awaiter(caller, yielder);
+		using promise_type = co_task_promise<T>;
+		using value_type = T;
+
+		struct awaiter
+		{
+			coroutine_handle<promise_type> handle;
+
+			bool await_ready() noexcept {
+				return false;
 			}
+			coroutine_handle<> await_suspend(coroutine_handle<> continuation) noexcept {
+				handle.promise().continuation = continuation;
+				return handle;
+			}
+			T await_resume() {
+				return handle.promise().result();
+			}
+		};
+
+		explicit co_task(coroutine_handle<promise_type> h) : handle(h) {}
+		co_task(const co_task&) = delete;
+		co_task& operator=(const co_task&) = delete;
+		co_task(co_task&& o) noexcept : handle(std::exchange(o.handle, nullptr)) {}
+		co_task& operator=(co_task&& o) noexcept {
+			if (this != std::addressof(o)) {
+				this->~co_task();
+				handle = std::exchange(o.handle, nullptr);
+			}
+			return *this;
 		}
-		co_caller_awaiter initial_suspend() const {
-			return co_caller_awaiter(caller, yielder);
-		}
-		co_caller_awaiter final_suspend() const {
-			emit_error().get();
-			// emit end iterator
-			value = nullptr;
-			return co_caller_awaiter(caller, yielder);
-		}
-		co_generator<yield_value_promise<value_type>> get_return_object() const {
-			return co_generator<yield_value_promise<value_type>>(*this);
+		~co_task() {
+			if (handle) {
+				handle.destroy();
+			}
 		}
 
-		co_caller_awaiter yield_value(value_type& v) const {
-			value = std::addressof(v);
-			return co_caller_awaiter(caller, yielder);
+		awaiter operator co_await() const noexcept {
+			return awaiter{handle};
 		}
-		co_caller_awaiter yield_value(value_type&& v) const {
-			value = std::addressof(v);
-			return co_caller_awaiter(caller, yielder);
+
+	private:
+		coroutine_handle<promise_type> handle;
+	};
+
+	struct co_task_promise_base : co_frame_allocation
+	{
+		struct final_awaiter
+		{
+			bool await_ready() noexcept {
+				return false;
+			}
+			template<typename Promise>
+			coroutine_handle<> await_suspend(coroutine_handle<Promise> handle) noexcept {
+				auto c = handle.promise().continuation;
+				if (c) {
+					return c;
+				}
+				return noop_coroutine();
+			}
+			void await_resume() noexcept {
+			}
+		};
+
+		suspend_always initial_suspend() const noexcept {
+			return suspend_always{};
 		}
-		void return_void() const {
-			assert(value == nullptr);
+		final_awaiter final_suspend() const noexcept {
+			return final_awaiter{};
 		}
-		void set_exception(std::exception_ptr ep) const {
-			error.set(ep);
+		void unhandled_exception() {
+			error = std::current_exception();
 		}
 
-		void destroy() const {
-			auto y = yielder;
-			yielder = nullptr;
-			if (y) {
-				y.destroy();
-			}
-		}
+		coroutine_handle<> continuation;
+		std::exception_ptr error;
 	};
 
 	template<typename T>
-	using co_value_generator = co_generator<yield_value_promise<T>>;
-
-	template<typename T>
-	struct merge_value_promise : co_generator_promise<T>
+	struct co_task_promise : co_task_promise_base
 	{
-		using value_type = T;
+		co_task<T> get_return_object() {
+			return co_task<T>(coroutine_handle<co_task_promise>::from_promise(*this));
+		}
+		template<typename V>
+		void return_value(V&& v) {
+			value.emplace(std::forward<V>(v));
+		}
+		T result() {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return std::move(*value);
+		}
 
-		using get = co_get_promise<merge_value_promise<T>>;
+		std::optional<T> value;
+	};
+
+	template<>
+	struct co_task_promise<void> : co_task_promise_base
+	{
+		co_task<void> get_return_object() {
+			return co_task<void>(coroutine_handle<co_task_promise>::from_promise(*this));
+		}
+		void return_void() {
+		}
+		void result() {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	};
+
+	// a one shot event that a thread can block on. the waiter may destroy
+	// the event as soon as wait() returns, so set() notifies under the
+	// lock; an atomic store followed by a notify would touch the event
+	// after the waiter could have seen the flag and left.
+	class co_sync_event
+	{
+	public:
+		void set() {
+			std::lock_guard<std::mutex> guard(lock);
+			flag = true;
+			signal.notify_one();
+		}
+		void wait() {
+			std::unique_lock<std::mutex> guard(lock);
+			signal.wait(guard, [this] { return flag; });
+		}
+
+	private:
+		std::mutex lock;
+		std::condition_variable signal;
+		bool flag = false;
+	};
+
+	template<typename Awaitable, typename = void>
+	struct co_await_result
+	{
+		using type = decltype(std::declval<Awaitable&>().await_resume());
+	};
+
+	template<typename Awaitable>
+	struct co_await_result<Awaitable, decltype(void(std::declval<Awaitable&>().operator co_await()))>
+	{
+		using type = decltype(std::declval<Awaitable&>().operator co_await().await_resume());
+	};
+
+	template<typename Result>
+	using co_sync_result = std::optional<std::conditional_t<std::is_void<Result>::value, bool, Result>>;
+
+	template<typename Result, typename Awaitable>
+	co_detached sync_wait_run(Awaitable& awaitable, co_sync_event& done, co_sync_result<Result>& result, std::exception_ptr& error) {
+		try
+		{
+			if constexpr (std::is_void<Result>::value) {
+				co_await awaitable;
+				result.emplace();
+			}
+			else {
+				result.emplace(co_await awaitable);
+			}
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		done.set();
+	}
+
+	// awaits on the calling thread and blocks it until the awaitable
+	// completes. a pipeline that completes synchronously never blocks.
+	template<typename Awaitable, typename Result = std::decay_t<typename co_await_result<std::remove_reference_t<Awaitable>>::type>>
+	Result sync_wait(Awaitable&& awaitable) {
+		co_sync_event done;
+		co_sync_result<Result> result;
+		std::exception_ptr error;
+		sync_wait_run<Result>(awaitable, done, result, error);
+		done.wait();
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		if constexpr (!std::is_void<Result>::value) {
+			return std::move(*result);
+		}
+	}
+
+	// contiguous ring of values. the storage is a power of two and doubles
+	// when a push finds it full, so a bounded user never reallocates once
+	// it has reached its bound.
+	template<typename T>
+	struct co_ring
+	{
+		co_ring() = default;
+		explicit co_ring(std::size_t capacity) {
+			reserve(capacity);
+		}
+		co_ring(const co_ring &) = delete;
+		co_ring & operator=(const co_ring &) = delete;
+		co_ring(co_ring && o) noexcept :
+			data(std::move(o.data)), mask(o.mask), head(o.head), count(o.count) {
+			o.mask = o.head = o.count = 0;
+		}
+		co_ring & operator=(co_ring && o) noexcept {
+			if (this != std::addressof(o)) {
+				clear();
+				data = std::move(o.data);
+				mask = o.mask;
+				head = o.head;
+				count = o.count;
+				o.mask = o.head = o.count = 0;
+			}
+			return *this;
+		}
+		~co_ring() {
+			clear();
+		}
+
+		std::size_t size() const {
+			return count;
+		}
+		bool empty() const {
+			return count == 0;
+		}
+		std::size_t capacity() const {
+			return !data ? 0 : mask + 1;
+		}
+
+		T& operator[](std::size_t i) {
+			return *slot(i);
+		}
+		T const & operator[](std::size_t i) const {
+			return *slot(i);
+		}
+		T& front() {
+			return *slot(0);
+		}
+		T& back() {
+			return *slot(count - 1);
+		}
+
+		template<typename... A>
+		T& emplace_back(A&&... a) {
+			if (count == capacity()) {
+				reserve(count + 1);
+			}
+			auto p = ::new (static_cast<void*>(slot(count))) T(std::forward<A>(a)...);
+			++count;
+			return *p;
+		}
+		void push_back(T v) {
+			emplace_back(std::move(v));
+		}
+		void pop_front() {
+			slot(0)->~T();
+			head = (head + 1) & mask;
+			--count;
+		}
+		void clear() {
+			while (count != 0) {
+				pop_front();
+			}
+			head = 0;
+		}
+
+		void reserve(std::size_t n) {
+			if (n <= capacity()) {
+				return;
+			}
+			std::size_t c = 1;
+			while (c < n) {
+				c <<= 1;
+			}
+			std::unique_ptr<storage[]> next(new storage[c]);
+			for (std::size_t i = 0; i != count; ++i) {
+				::new (static_cast<void*>(std::addressof(next[i]))) T(std::move(*slot(i)));
+				slot(i)->~T();
+			}
+			data = std::move(next);
+			mask = c - 1;
+			head = 0;
+		}
+
+	private:
+		using storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+		T* slot(std::size_t i) const {
+			return reinterpret_cast<T*>(std::addressof(data[(head + i) & mask]));
+		}
+
+		std::unique_ptr<storage[]> data;
+		std::size_t mask = 0;
+		std::size_t head = 0;
+		std::size_t count = 0;
+	};
+
+	// bounded single producer single consumer queue. the indices live on
+	// separate cache lines and each side caches the other's index, so an
+	// uncontended push or pop touches no shared line.
+	template<typename T>
+	class co_spsc_queue
+	{
+	public:
+		explicit co_spsc_queue(std::size_t capacity) {
+			std::size_t c = 2;
+			while (c < capacity) {
+				c <<= 1;
+			}
+			data.reset(new storage[c]);
+			mask = c - 1;
+		}
+
+		co_spsc_queue(const co_spsc_queue&) = delete;
+		co_spsc_queue& operator=(const co_spsc_queue&) = delete;
+
+		~co_spsc_queue() {
+			while (pop()) {
+			}
+		}
+
+		// producer
+		bool push(T&& v) {
+			auto t = tail.load(std::memory_order_relaxed);
+			if (t - head_cache > mask) {
+				head_cache = head.load(std::memory_order_acquire);
+				if (t - head_cache > mask) {
+					return false;
+				}
+			}
+			::new (static_cast<void*>(slot(t))) T(std::move(v));
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer
+		std::optional<T> pop() {
+			auto h = head.load(std::memory_order_relaxed);
+			if (h == tail_cache) {
+				tail_cache = tail.load(std::memory_order_acquire);
+				if (h == tail_cache) {
+					return std::nullopt;
+				}
+			}
+			std::optional<T> v(std::move(*slot(h)));
+			slot(h)->~T();
+			head.store(h + 1, std::memory_order_release);
+			return v;
+		}
+
+		// either side, exact only on the consumer side
+		bool empty() const {
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+		bool full() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) > mask;
+		}
+
+	private:
+		using storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+		T* slot(std::size_t i) const {
+			return reinterpret_cast<T*>(std::addressof(data[i & mask]));
+		}
+
+		std::unique_ptr<storage[]> data;
+		std::size_t mask = 0;
+		alignas(64) std::atomic<std::size_t> head{0};
+		std::size_t tail_cache = 0;
+		alignas(64) std::atomic<std::size_t> tail{0};
+		std::size_t head_cache = 0;
+	};
+
+	// open addressing hash map with linear probing. erase shifts the entries
+	// that follow back into place, so probes never walk over tombstones.
+	// Key and Value must be default constructible.
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+	struct co_flat_map
+	{
+		struct slot
+		{
+			Key key{};
+			Value value{};
+			bool used = false;
+		};
+
+		co_flat_map() = default;
+		explicit co_flat_map(std::size_t capacity) {
+			reserve(capacity);
+		}
+
+		std::size_t size() const {
+			return count;
+		}
+		bool empty() const {
+			return count == 0;
+		}
+
+		Value* find(Key const & key) {
+			if (count == 0) {
+				return nullptr;
+			}
+			for (auto i = home(key);; i = (i + 1) & mask) {
+				auto& s = slots[i];
+				if (!s.used) {
+					return nullptr;
+				}
+				if (equal(s.key, key)) {
+					return std::addressof(s.value);
+				}
+			}
+		}
+
+		// returns the value stored for key and whether it was inserted
+		std::pair<Value*, bool> insert(Key key, Value value) {
+			if ((count + 1) * 4 > slots.size() * 3) {
+				rehash(slots.empty() ? 16 : slots.size() * 2);
+			}
+			for (auto i = home(key);; i = (i + 1) & mask) {
+				auto& s = slots[i];
+				if (!s.used) {
+					s.key = std::move(key);
+					s.value = std::move(value);
+					s.used = true;
+					++count;
+					return std::make_pair(std::addressof(s.value), true);
+				}
+				if (equal(s.key, key)) {
+					return std::make_pair(std::addressof(s.value), false);
+				}
+			}
+		}
+
+		bool erase(Key const & key) {
+			if (count == 0) {
+				return false;
+			}
+			auto i = home(key);
+			for (;; i = (i + 1) & mask) {
+				if (!slots[i].used) {
+					return false;
+				}
+				if (equal(slots[i].key, key)) {
+					break;
+				}
+			}
+			for (auto j = i;;) {
+				j = (j + 1) & mask;
+				if (!slots[j].used) {
+					break;
+				}
+				// an entry only moves back if its home is not between the hole and itself
+				auto k = home(slots[j].key);
+				if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+					continue;
+				}
+				slots[i] = std::move(slots[j]);
+				i = j;
+			}
+			slots[i] = slot();
+			--count;
+			return true;
+		}
+
+		template<typename F>
+		void for_each(F f) {
+			for (auto& s : slots) {
+				if (s.used) {
+					f(s.key, s.value);
+				}
+			}
+		}
+
+		void clear() {
+			for (auto& s : slots) {
+				s = slot();
+			}
+			count = 0;
+		}
+
+		void reserve(std::size_t n) {
+			std::size_t c = 16;
+			while (c * 3 < n * 4) {
+				c <<= 1;
+			}
+			if (c > slots.size()) {
+				rehash(c);
+			}
+		}
+
+	private:
+		std::size_t home(Key const & key) const {
+			// fibonacci hashing spreads std::hash results that are the identity for integers
+			return static_cast<std::size_t>((static_cast<std::uint64_t>(hash(key)) * 0x9E3779B97F4A7C15ull) >> shift);
+		}
+
+		void rehash(std::size_t capacity) {
+			std::vector<slot> old(capacity);
+			old.swap(slots);
+			mask = capacity - 1;
+			shift = 64;
+			for (auto c = capacity; c > 1; c >>= 1) {
+				--shift;
+			}
+			count = 0;
+			for (auto& s : old) {
+				if (s.used) {
+					insert(std::move(s.key), std::move(s.value));
+				}
+			}
+		}
+
+		std::vector<slot> slots;
+		std::size_t count = 0;
+		std::size_t mask = 0;
+		unsigned shift = 64;
+		Hash hash;
+		Equal equal;
+	};
+
+	template<typename Bind>
+	struct co_operator
+	{
+		Bind bind;
+	};
+
+	template<typename Bind>
+	co_operator<Bind> make_operator(Bind bind) {
+		return co_operator<Bind>{std::move(bind)};
+	}
+
+	template<typename T>
+	struct yield_value_promise : co_generator_promise<T>
+	{
+		using typename co_generator_promise<T>::value_type;
+		using co_generator_promise<T>::value;
+		using co_generator_promise<T>::caller;
+		using co_generator_promise<T>::yielder;
+		using co_generator_promise<T>::done;
+		using co_generator_promise<T>::error;
+
+		co_caller_awaiter initial_suspend() const noexcept {
+			return co_caller_awaiter(caller, yielder);
+		}
+		co_caller_awaiter final_suspend() const noexcept {
+			// emit the error value, if any, before the end iterator
+			value = error.yield();
+			done = true;
+			return co_caller_awaiter(caller, yielder);
+		}
+		co_generator<yield_value_promise<value_type>> get_return_object() const {
+			return co_generator<yield_value_promise<value_type>>(*this);
+		}
+
+		co_caller_awaiter yield_value(value_type& v) const {
+			value = std::addressof(v);
+			co_trace_hop();
+			return co_caller_awaiter(caller, yielder);
+		}
+		co_caller_awaiter yield_value(value_type&& v) const {
+			value = std::addressof(v);
+			co_trace_hop();
+			return co_caller_awaiter(caller, yielder);
+		}
+		void return_void() const {
+			assert(value == nullptr);
+		}
+		void unhandled_exception() const {
+			error.set(std::current_exception());
+		}
+
+		void destroy() const {
+			coroutine_handle<yield_value_promise>::from_promise(const_cast<yield_value_promise&>(*this)).destroy();
+		}
+	};
+
+	template<typename T>
+	using co_value_generator = co_generator<yield_value_promise<T>>;
+
+	template<typename T>
+	struct merge_value_promise : co_generator_promise<T>
+	{
+		using value_type = T;
+		using co_generator_promise<T>::value;
+		using co_generator_promise<T>::caller;
+		using co_generator_promise<T>::yielder;
+		using co_generator_promise<T>::done;
+		using co_generator_promise<T>::error;
+
+		using get = co_get_promise<merge_value_promise<T>>;
+
+		// a source suspended until the consumer takes its value
+		struct merge_pending
+		{
+			coroutine_handle<> handle;
+			value_type* value;
+#if defined(CO_ALG_TRACE)
+			co_trace_context* trace;
+#endif
+		};
 
 		struct merge_caller_awaiter
 		{
 			merge_caller_awaiter(
 				const merge_value_promise<T>* that,
-				bool* canceled) :
+				bool* canceled,
+				value_type* value) :
 				m_that(that),
-				m_canceled(canceled)
+				m_canceled(canceled),
+				m_value(value)
 			{}
 
 			bool await_ready() {
 				return false;
 			}
 
-			void await_suspend(const std::experimental::coroutine_handle<>& handle) {
+			coroutine_handle<> await_suspend(coroutine_handle<> handle) {
 				if (!!m_that->yielder) {
-					m_that->pending.push_back(handle);
-				}
-				else {
-					m_that->yielder = handle;
+					// the consumer has not taken the last value yet
+#if defined(CO_ALG_TRACE)
+					// the value takes its trace with it
+					m_that->pending.push_back(merge_pending{handle, m_value, std::exchange(co_trace_context::current(), nullptr)});
+#else
+					m_that->pending.push_back(merge_pending{handle, m_value});
+#endif
+					return noop_coroutine();
 				}
+				m_that->yielder = handle;
+				m_that->value = m_value;
 				auto c = m_that->caller;
 				m_that->caller = nullptr;
 				if (!!c) {
-					c();
+					return c;
 				}
+				return noop_coroutine();
 			}
 
 			void await_resume() {
@@ -365,19 +1581,38 @@ namespace co_alg {
 				}
 				m_that->yielder = nullptr;
 				if (!m_that->pending.empty()) {
-					m_that->yielder = m_that->pending.front();
+					auto next = m_that->pending.front();
 					m_that->pending.pop_front();
+					m_that->yielder = next.handle;
+					m_that->value = next.value;
 					auto c = m_that->caller;
 					m_that->caller = nullptr;
+#if defined(CO_ALG_TRACE)
+					if (next.trace) {
+						// the time spent in pending
+						next.trace->hop();
+						auto previous = std::exchange(co_trace_context::current(), next.trace);
+						c();
+						if (co_trace_context::current() == next.trace && next.trace->active) {
+							next.trace->trace->abandon(next.trace);
+						}
+						co_trace_context::current() = previous;
+					}
+					else {
+						c();
+					}
+#else
 					c();
+#endif
 				}
 			}
 
 			const merge_value_promise<T>* m_that;
 			bool* m_canceled;
+			value_type* m_value;
 		};
-		merge_caller_awaiter caller_awaiter(bool* canceled) const {
-			return merge_caller_awaiter(this, canceled);
+		merge_caller_awaiter caller_awaiter(bool* canceled, value_type* v) const {
+			return merge_caller_awaiter(this, canceled, v);
 		}
 
 		struct merge_complete_awaiter
@@ -387,103 +1622,93 @@ namespace co_alg {
 				m_that(that)
 			{}
 
-			bool await_ready() {
-				return m_that->sources == 0 && !m_that->yielder && m_that->pending.empty();
-			}
-
-			void await_suspend(const std::experimental::coroutine_handle<>& handle) {
-				m_that->completer = handle;
+			bool await_ready() noexcept {
+				return false;
 			}
 
-			std::future<void> emit_error() const {
-				m_that->value = m_that->error.yield();
-				if (m_that->value) {
-					co_await m_that->caller_awaiter(nullptr);
+			void await_suspend(coroutine_handle<> handle) noexcept {
+				if (m_that->abandoned) {
+					handle.destroy();
+					return;
 				}
+				// the frame stays suspended here until the generator is destroyed
+				m_that->completer = handle;
+				m_that->complete();
 			}
 
-			void await_resume() {
-				if (!m_that->caller) {
-					std::terminate();
-				}
-
-				m_that->stop();
-
-				emit_error().get();
-
-				// resume with end iterator
-				m_that->value = nullptr;
-				auto c = m_that->caller;
-				m_that->caller = nullptr;
-				c();
+			void await_resume() noexcept {
 			}
 
 			const merge_value_promise<T>* m_that;
 		};
-		merge_complete_awaiter complete_awaiter() const {
+		merge_complete_awaiter complete_awaiter() const noexcept {
 			return merge_complete_awaiter(this);
 		}
 
-		std::experimental::suspend_never initial_suspend() const {
+		suspend_never initial_suspend() const noexcept {
 			++sources;
-			return std::experimental::suspend_never{};
+			return suspend_never{};
 		}
-		merge_complete_awaiter final_suspend() const {
+		merge_complete_awaiter final_suspend() const noexcept {
 			--sources;
 			return complete_awaiter();
 		}
 		co_generator<merge_value_promise<value_type>> get_return_object() const {
 			return co_generator<merge_value_promise<value_type>>(*this);
 		}
-		void set_exception(std::exception_ptr ep) const {
-			error.set(ep);
+		void return_void() const {
+		}
+		void unhandled_exception() const {
+			error.set(std::current_exception());
 			stop();
 		}
 
 		struct merge_source_awaiter
 		{
-			struct promise_type
+			struct promise_type : co_frame_allocation
 			{
-				std::experimental::suspend_never initial_suspend() const {
-					return std::experimental::suspend_never{};
+				suspend_never initial_suspend() const noexcept {
+					return suspend_never{};
 				}
-				std::experimental::suspend_never final_suspend() const {
-					if (!*canceled) {
+				suspend_never final_suspend() const noexcept {
+					if (!canceled) {
 						--that->sources;
-						that->cancels.erase(canceled);
+						that->cancels.erase(std::addressof(canceled));
 						that->complete();
 					}
-					return std::experimental::suspend_never{};
+					return suspend_never{};
 				}
 				merge_source_awaiter get_return_object() const {
 					return merge_source_awaiter{};
 				}
 
 				merge_caller_awaiter yield_value(value_type& v) const {
-					assert(!*canceled);
-					that->value = std::addressof(v);
-					return that->caller_awaiter(canceled);
+					assert(!canceled);
+					co_trace_hop();
+					return that->caller_awaiter(std::addressof(canceled), std::addressof(v));
 				}
 				merge_caller_awaiter yield_value(value_type&& v) const {
-					assert(!*canceled);
-					that->value = std::addressof(v);
-					return that->caller_awaiter(canceled);
+					assert(!canceled);
+					co_trace_hop();
+					return that->caller_awaiter(std::addressof(canceled), std::addressof(v));
+				}
+				void return_void() const {
 				}
-				void set_exception(std::exception_ptr ep) const {
-					assert(!*canceled);
-					that->error.set(ep);
+				void unhandled_exception() const {
+					assert(!canceled);
+					that->error.set(std::current_exception());
 					that->stop();
+					that->complete();
 				}
 
-				void bind(const merge_value_promise<T>* t, bool& c) const {
+				void bind(const merge_value_promise<T>* t) const {
 					that = t;
 					++that->sources;
-					canceled = std::addressof(c);
-					that->cancels.insert(canceled);
+					that->cancels.insert(std::addressof(canceled));
 				}
 
-				mutable const merge_value_promise<T>* that;
-				mutable bool* canceled;
+				mutable const merge_value_promise<T>* that = nullptr;
+				mutable bool canceled = false;
 			};
 
 			using get = co_get_promise<promise_type>;
@@ -491,25 +1716,32 @@ namespace co_alg {
 
 		template<class Source>
 		merge_source_awaiter push(Source s) const {
-			bool canceled = false;
-			auto& p = co_await merge_source_awaiter::get();
-			p.bind(this, canceled);
-			for co_await (auto& v : s) {
-				if (canceled) {
+			auto& p = co_await typename merge_source_awaiter::get();
+			p.bind(this);
+			auto it = co_await s.begin();
+			while (it != s.end()) {
+				if (p.canceled) {
 					break;
 				}
-				co_yield v;
-				if (canceled) {
+				co_yield *it;
+				if (p.canceled) {
 					break;
 				}
+				co_await ++it;
 			}
 		}
 
 		void complete() const {
-			if (!!completer && sources == 0 && !yielder && pending.empty()) {
-				auto c = completer;
-				completer = nullptr;
-				c();
+			if (!!completer && !done && sources == 0 && !yielder && pending.empty()) {
+				stop();
+				// emit the error value, if any, before the end iterator
+				value = error.yield();
+				done = true;
+				auto c = caller;
+				caller = nullptr;
+				if (!!c) {
+					c();
+				}
 			}
 		}
 
@@ -517,170 +1749,2427 @@ namespace co_alg {
 			for (auto c : cancels) {
 				*c = true;
 			}
+			sources -= static_cast<int>(cancels.size());
 			cancels.clear();
 			auto y = yielder;
 			yielder = nullptr;
-			if (y) {
+			// the merge body itself is parked in yielder until the first advance
+			if (y && y != coroutine_handle<merge_value_promise>::from_promise(const_cast<merge_value_promise&>(*this))) {
 				y();
 			}
 			auto p = pending;
 			pending.clear();
 			for (auto& h : p) {
-				h();
+#if defined(CO_ALG_TRACE)
+				if (h.trace) {
+					h.trace->trace->abandon(h.trace);
+				}
+#endif
+				h.handle();
 			}
 		}
 
 		void destroy() const {
 			stop();
-			complete();
+			if (pushing) {
+				// a source resumed the consumer from inside push(), the
+				// body destroys its own frame once push() returns.
+				abandoned = true;
+				return;
+			}
+			coroutine_handle<merge_value_promise>::from_promise(const_cast<merge_value_promise&>(*this)).destroy();
 		}
 
 		mutable int sources{};
-		mutable std::deque<std::experimental::coroutine_handle<>> pending{};
-		mutable std::experimental::coroutine_handle<> completer{};
+		mutable bool pushing = false;
+		mutable bool abandoned = false;
+		mutable std::deque<merge_pending> pending{};
+		mutable coroutine_handle<> completer{};
 		mutable std::set<bool*> cancels;
 	};
 
-	template<typename Source, typename SourceValue = std::decay_t<Source>::value_type::value_type>
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type::value_type>
 	co_generator<merge_value_promise<SourceValue>> merge(Source source) {
-		auto& p = co_await merge_value_promise<SourceValue>::get();
-		co_await p.caller_awaiter(nullptr);
-		for co_await (auto&& s : source) {
-			p.push(std::move(s));
+		auto& p = co_await typename merge_value_promise<SourceValue>::get();
+		co_await p.caller_awaiter(nullptr, nullptr);
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			p.pushing = true;
+			p.push(std::move(*it));
+			p.pushing = false;
+			if (p.abandoned) {
+				break;
+			}
+			co_await ++it;
 		}
 	}
 
-	template<typename Source, typename SourceValue = std::decay_t<Source>::value_type::value_type>
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type::value_type>
 	co_value_generator<SourceValue> concat(Source source) {
-		for co_await (auto&& s : source) {
-			for co_await (auto&& v : s) {
-				co_yield v;
+		auto s = co_await source.begin();
+		while (s != source.end()) {
+			auto v = co_await s->begin();
+			while (v != s->end()) {
+				co_yield *v;
+				co_await ++v;
 			}
+			co_await ++s;
 		}
 	}
 
 	template<typename Trigger>
-	std::future<void> pulltrigger(Trigger trigger, bool& triggered, bool*& cancelTrigger) {
+	co_detached pulltrigger(Trigger trigger, bool& triggered, bool*& cancelTrigger) {
 		bool canceled = false;
 		cancelTrigger = &canceled;
-		for co_await (auto&& v : trigger) {
+		auto it = co_await trigger.begin();
+		while (it != trigger.end()) {
 			if (canceled) {
-				return;
+				co_return;
 			}
 			triggered = true;
+			co_await ++it;
+		}
+		if (!canceled) {
+			cancelTrigger = nullptr;
 		}
-		cancelTrigger = nullptr;
 	}
 
-	template<typename Source, typename Trigger, typename SourceValue = std::decay_t<Source>::value_type>
+	// cancels the trigger when take_until completes or is destroyed
+	struct trigger_canceler
+	{
+		bool*& cancelTrigger;
+		~trigger_canceler() {
+			if (!!cancelTrigger) {
+				*cancelTrigger = true;
+			}
+		}
+	};
+
+	template<typename Source, typename Trigger, typename SourceValue = typename std::decay_t<Source>::value_type>
 	co_value_generator<SourceValue> take_until(Source source, Trigger trigger) {
 		bool triggered = false;
 		bool* cancelTrigger = nullptr;
-		pulltrigger(trigger, triggered, cancelTrigger);
-		for co_await (auto&& v : source) {
+		trigger_canceler canceler{cancelTrigger};
+		pulltrigger(std::move(trigger), triggered, cancelTrigger);
+		auto it = co_await source.begin();
+		while (it != source.end()) {
 			if (triggered) {
-				return;
+				co_return;
 			}
-			co_yield v;
-		}
-		if (!!cancelTrigger) {
-			*cancelTrigger = true;
+			co_yield *it;
+			co_await ++it;
 		}
 	}
 
-	template<typename Source, typename Selector, typename SourceValue = std::decay_t<Source>::value_type, typename SelectValue = std::result_of_t<Selector(SourceValue const &)>>
+	template<typename Source, typename Selector, typename SourceValue = typename std::decay_t<Source>::value_type, typename SelectValue = std::decay_t<std::invoke_result_t<Selector&, SourceValue const &>>>
 	co_value_generator<SelectValue> transform(Source source, Selector select) {
-		for co_await (auto&& v : source) {
-			co_yield select(v);
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			co_yield select(*it);
+			co_await ++it;
 		}
 	}
 
-	template<typename Source, typename Predicate, typename SourceValue = std::decay_t<Source>::value_type>
+	template<typename Source, typename Predicate, typename SourceValue = typename std::decay_t<Source>::value_type>
 	co_value_generator<SourceValue> filter(Source source, Predicate predicate) {
-		for co_await (auto&& v : source) {
-			if (predicate(std::cref(v).get())) {
-				co_yield v;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if (predicate(std::cref(*it).get())) {
+				co_yield *it;
 			}
+			co_await ++it;
 		}
 	}
 
-	template<typename Source, typename SourceValue = std::decay_t<Source>::value_type>
-	co_value_generator<SourceValue> take(Source source, ptrdiff_t count) {
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> take(Source source, std::ptrdiff_t count) {
 		if (count == 0) {
-			return;
+			co_return;
 		}
-		for co_await (auto&& v : source) {
-			co_yield v;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			co_yield *it;
 			if (--count == 0) {
 				break;
 			}
+			co_await ++it;
 		}
 	}
 
-	template<typename Source, typename SourceValue = std::decay_t<Source>::value_type>
-	co_value_generator<SourceValue> skip(Source source, ptrdiff_t count) {
-		for co_await (auto&& v : source) {
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> skip(Source source, std::ptrdiff_t count) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
 			if (count == 0) {
-				co_yield v;
+				co_yield *it;
+			}
+			else {
+				--count;
+			}
+			co_await ++it;
+		}
+	}
+
+	template<typename Exception, typename Source, typename Selector, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> resume_error(Source source, Selector select) {
+		Exception e;
+		bool error = false;
+		try
+		{
+			auto it = co_await source.begin();
+			while (it != source.end()) {
+				co_yield *it;
+				co_await ++it;
+			}
+		}
+		catch (const Exception& ex)
+		{
+			e = ex;
+			error = true;
+		}
+		if (error) {
+			auto s = select(e);
+			auto it = co_await s.begin();
+			while (it != s.end()) {
+				co_yield *it;
+				co_await ++it;
+			}
+		}
+	}
+
+	template<typename Source, typename Seed, typename Accumulate>
+	co_value_generator<Seed> scan(Source source, Seed seed, Accumulate accumulate) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			seed = accumulate(std::move(seed), *it);
+			co_yield seed;
+			co_await ++it;
+		}
+	}
+
+	// the whole reduction runs in one coroutine frame, no generator is
+	// created per value.
+	template<typename Source, typename Seed, typename Accumulate>
+	co_value_generator<Seed> reduce(Source source, Seed seed, Accumulate accumulate) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			seed = accumulate(std::move(seed), *it);
+			co_await ++it;
+		}
+		co_yield seed;
+	}
+
+	// describes how the numeric aggregates fold a value. arithmetic values
+	// are summed in a wide type. contiguous chunks of arithmetic values, like
+	// the batches from merge_sorted, are reduced a chunk at a time.
+	template<typename T, typename = void>
+	struct co_numeric
+	{
+		using element_type = T;
+		using sum_type = T;
+
+		static sum_type add(sum_type s, T const & v) {
+			return std::move(s) + v;
+		}
+		static std::size_t count(T const &) {
+			return 1;
+		}
+		template<typename Compare>
+		static bool best(element_type& b, T const & v, Compare&) {
+			b = v;
+			return true;
+		}
+	};
+
+	template<typename T>
+	struct co_numeric<T, std::enable_if_t<std::is_arithmetic<T>::value>>
+	{
+		using element_type = T;
+		using sum_type = std::conditional_t<std::is_floating_point<T>::value,
+			std::conditional_t<(sizeof(T) < sizeof(double)), double, T>,
+			std::conditional_t<std::is_signed<T>::value, long long, unsigned long long>>;
+
+		static sum_type add(sum_type s, T v) {
+			return s + v;
+		}
+		static std::size_t count(T) {
+			return 1;
+		}
+		template<typename Compare>
+		static bool best(element_type& b, T v, Compare&) {
+			b = v;
+			return true;
+		}
+	};
+
+	// the element type of a contiguous chunk, void for values that are not
+	// chunks. strings are text, not chunks of numbers.
+	template<typename T, typename = void>
+	struct co_chunk_element
+	{
+		using type = void;
+	};
+
+	template<typename T, typename = void>
+	struct co_is_text : std::false_type {};
+
+	template<typename T>
+	struct co_is_text<T, decltype(void(std::declval<typename T::traits_type*>()))> : std::true_type {};
+
+	template<typename T>
+	struct co_chunk_element<T, decltype(void(std::declval<T const &>().data()), void(std::declval<T const &>().size()))>
+	{
+		using type = std::conditional_t<co_is_text<T>::value, void, std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<T const &>().data())>>>;
+	};
+
+	template<typename T>
+	struct co_numeric<T, std::enable_if_t<std::is_arithmetic<typename co_chunk_element<T>::type>::value>>
+	{
+		using element_type = typename co_chunk_element<T>::type;
+		using sum_type = typename co_numeric<element_type>::sum_type;
+
+		static sum_type add(sum_type s, T const & chunk) {
+			// independent accumulators break the dependency between
+			// iterations so that the loop vectorizes, floating point included
+			auto p = chunk.data();
+			auto n = static_cast<std::size_t>(chunk.size());
+			sum_type a0{}, a1{}, a2{}, a3{};
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				a0 += p[i];
+				a1 += p[i + 1];
+				a2 += p[i + 2];
+				a3 += p[i + 3];
+			}
+			for (; i < n; ++i) {
+				a0 += p[i];
+			}
+			return s + ((a0 + a1) + (a2 + a3));
+		}
+		static std::size_t count(T const & chunk) {
+			return static_cast<std::size_t>(chunk.size());
+		}
+		// sets b to the best element of the chunk, false when it is empty
+		template<typename Compare>
+		static bool best(element_type& b, T const & chunk, Compare& compare) {
+			auto p = chunk.data();
+			auto n = static_cast<std::size_t>(chunk.size());
+			if (n == 0) {
+				return false;
+			}
+			auto m = p[0];
+			for (std::size_t i = 1; i < n; ++i) {
+				m = compare(p[i], m) ? p[i] : m;
+			}
+			b = m;
+			return true;
+		}
+	};
+
+	template<typename Source>
+	co_value_generator<std::size_t> count(Source source) {
+		std::size_t n = 0;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			++n;
+			co_await ++it;
+		}
+		co_yield n;
+	}
+
+	// arithmetic values are summed in long long, unsigned long long or
+	// double. chunks are summed element wise.
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type, typename Numeric = co_numeric<SourceValue>>
+	co_value_generator<typename Numeric::sum_type> sum(Source source) {
+		typename Numeric::sum_type s{};
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			s = Numeric::add(std::move(s), *it);
+			co_await ++it;
+		}
+		co_yield s;
+	}
+
+	template<typename Source, typename Compare, typename SourceValue = typename std::decay_t<Source>::value_type, typename Numeric = co_numeric<SourceValue>>
+	co_value_generator<typename Numeric::element_type> best_of(Source source, Compare compare) {
+		typename Numeric::element_type b{};
+		typename Numeric::element_type c{};
+		bool found = false;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if (Numeric::best(c, *it, compare) && (!found || compare(std::cref(c).get(), std::cref(b).get()))) {
+				b = std::move(c);
+				found = true;
+			}
+			co_await ++it;
+		}
+		if (found) {
+			co_yield b;
+		}
+	}
+
+	// min and max complete without a value when the source is empty
+	template<typename Source, typename Compare>
+	auto min(Source source, Compare compare) {
+		return best_of(std::move(source), compare);
+	}
+
+	template<typename Source, typename Compare>
+	auto max(Source source, Compare compare) {
+		return best_of(std::move(source), [compare](auto const & a, auto const & b) {
+			return compare(b, a);
+		});
+	}
+
+	// the mean of arithmetic values, chunks count each of their elements.
+	// completes without a value when there are no elements.
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type, typename Numeric = co_numeric<SourceValue>,
+		typename Mean = std::conditional_t<std::is_floating_point<typename Numeric::sum_type>::value, typename Numeric::sum_type, double>>
+	co_value_generator<Mean> average(Source source) {
+		static_assert(std::is_arithmetic<typename Numeric::element_type>::value, "average requires arithmetic values or chunks of them");
+		typename Numeric::sum_type s{};
+		std::size_t n = 0;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			s = Numeric::add(s, *it);
+			n += Numeric::count(*it);
+			co_await ++it;
+		}
+		if (n != 0) {
+			co_yield static_cast<Mean>(s) / static_cast<Mean>(n);
+		}
+	}
+
+	template<typename T, typename Clock = co_tsc_clock>
+	struct co_timestamped
+	{
+		T value;
+		typename Clock::time_point at;
+	};
+
+	template<typename T, typename Clock = co_tsc_clock>
+	struct co_time_interval
+	{
+		T value;
+		typename Clock::duration interval;
+	};
+
+	// tags each value with the time it arrived
+	template<typename Clock = co_tsc_clock, typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<co_timestamped<SourceValue, Clock>> timestamp(Source source) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			co_timestamped<SourceValue, Clock> t{*it, Clock::now()};
+			co_yield t;
+			co_await ++it;
+		}
+	}
+
+	// tags each value with the time since the previous one arrived, or
+	// since the source was started for the first
+	template<typename Clock = co_tsc_clock, typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<co_time_interval<SourceValue, Clock>> time_interval(Source source) {
+		auto last = Clock::now();
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			auto now = Clock::now();
+			co_time_interval<SourceValue, Clock> t{*it, now - last};
+			last = now;
+			co_yield t;
+			co_await ++it;
+		}
+	}
+
+	template<typename Source, typename Key, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> distinct_until_changed(Source source, Key key) {
+		using key_type = std::decay_t<std::invoke_result_t<Key&, SourceValue const &>>;
+		std::optional<key_type> previous;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			auto k = key(std::cref(*it).get());
+			if (!previous || !(*previous == k)) {
+				previous = std::move(k);
+				co_yield *it;
+			}
+			co_await ++it;
+		}
+	}
+
+	// the exact form remembers every key it has seen
+	template<typename Source, typename Key, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> distinct(Source source, Key key) {
+		using key_type = std::decay_t<std::invoke_result_t<Key&, SourceValue const &>>;
+		co_flat_map<key_type, bool> seen;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if (seen.insert(key(std::cref(*it).get()), true).second) {
+				co_yield *it;
+			}
+			co_await ++it;
+		}
+	}
+
+	// bloom filter over a power of two number of bits. the probes are
+	// derived from one hash by double hashing.
+	template<typename Key, typename Hash = std::hash<Key>>
+	struct co_bloom_filter
+	{
+		co_bloom_filter(std::size_t bits, unsigned hashes) : probes(std::max(hashes, 1u)) {
+			std::size_t c = 64;
+			while (c < bits) {
+				c <<= 1;
+			}
+			words.resize(c / 64);
+			mask = c - 1;
+		}
+
+		bool contains(Key const & key) const {
+			auto h = mix(key);
+			for (unsigned i = 0; i < probes; ++i) {
+				auto b = (h.first + i * h.second) & mask;
+				if (!(words[b / 64] & (std::uint64_t(1) << (b % 64)))) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void insert(Key const & key) {
+			auto h = mix(key);
+			for (unsigned i = 0; i < probes; ++i) {
+				auto b = (h.first + i * h.second) & mask;
+				words[b / 64] |= std::uint64_t(1) << (b % 64);
+			}
+		}
+
+		void clear() {
+			std::fill(words.begin(), words.end(), 0);
+		}
+
+		void swap(co_bloom_filter& o) {
+			words.swap(o.words);
+			std::swap(mask, o.mask);
+			std::swap(probes, o.probes);
+		}
+
+	private:
+		std::pair<std::uint64_t, std::uint64_t> mix(Key const & key) const {
+			// the splitmix64 finalizer, std::hash is the identity for integers
+			auto h = static_cast<std::uint64_t>(hash(key));
+			h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+			h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+			h ^= h >> 31;
+			// an odd step visits distinct bits
+			return std::make_pair(h, (h >> 32) | 1);
+		}
+
+		std::vector<std::uint64_t> words;
+		std::size_t mask = 0;
+		unsigned probes;
+		Hash hash;
+	};
+
+	// the approximate form of distinct. keys are remembered in a bloom
+	// filter of bits bits, hashes probes each. every reset the filter is
+	// retired and a fresh one started, the retired one is still consulted
+	// until the next reset, so a key is remembered for at least reset.
+	// a false positive drops a value that was not a duplicate.
+	struct distinct_filter
+	{
+		std::size_t bits;
+		unsigned hashes;
+		std::chrono::steady_clock::duration reset = std::chrono::steady_clock::duration::max();
+	};
+
+	template<typename Source, typename Key, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> distinct(Source source, Key key, distinct_filter filter) {
+		using clock = std::chrono::steady_clock;
+		using key_type = std::decay_t<std::invoke_result_t<Key&, SourceValue const &>>;
+		co_bloom_filter<key_type> current(filter.bits, filter.hashes);
+		co_bloom_filter<key_type> retired(filter.bits, filter.hashes);
+		auto timed = filter.reset != clock::duration::max();
+		auto next = timed ? clock::now() + filter.reset : clock::time_point::max();
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if (timed) {
+				auto now = clock::now();
+				if (now >= next) {
+					next = now + filter.reset;
+					retired.swap(current);
+					current.clear();
+				}
+			}
+			auto k = key(std::cref(*it).get());
+			if (!current.contains(k) && !retired.contains(k)) {
+				current.insert(k);
+				co_yield *it;
+			}
+			co_await ++it;
+		}
+	}
+
+	// terminal operations. each consumes the source in one task, there is
+	// no generator per value.
+
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_task<std::vector<SourceValue>> to_vector(Source source, std::size_t reserve_hint) {
+		std::vector<SourceValue> values;
+		values.reserve(reserve_hint);
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			values.push_back(*it);
+			co_await ++it;
+		}
+		co_return values;
+	}
+
+	template<typename Source, typename F>
+	co_task<void> for_each(Source source, F f) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			f(*it);
+			co_await ++it;
+		}
+	}
+
+	// empty when the source completes without a value. the source is
+	// moved into a scope that ends after its first value, so it is
+	// destroyed, and canceled, before the task completes.
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_task<std::optional<SourceValue>> first(Source source) {
+		std::optional<SourceValue> value;
+		{
+			auto owned = std::move(source);
+			auto it = co_await owned.begin();
+			if (it != owned.end()) {
+				value.emplace(*it);
+			}
+		}
+		co_return value;
+	}
+
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_task<std::optional<SourceValue>> last(Source source) {
+		std::optional<SourceValue> value;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			value = *it;
+			co_await ++it;
+		}
+		co_return value;
+	}
+
+	template<typename T>
+	co_value_generator<T> empty() {
+		co_return;
+	}
+
+	template<typename T>
+	co_value_generator<T> never() {
+		for (;;) {
+			co_await suspend_always{};
+		}
+	}
+
+	inline co_value_generator<int> ints(int first, int last) {
+		for (int cursor = first;; ++cursor) {
+			co_yield cursor;
+			if (cursor == last) break;
+		}
+	}
+
+	// an awaiter that is ready at once, for sources that never suspend
+	template<typename T>
+	struct co_ready_awaiter
+	{
+		T result;
+
+		bool await_ready() noexcept {
+			return true;
+		}
+		void await_suspend(coroutine_handle<>) noexcept {
+		}
+		T await_resume() noexcept {
+			return result;
+		}
+	};
+
+	// the iterator of a source that walks memory. the source keeps the
+	// position, like the promise does for co_iterator, and ++ advances it
+	// without suspending.
+	template<typename Source>
+	struct co_range_iterator
+	{
+		using iterator_category = std::input_iterator_tag;
+		using value_type = typename Source::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = value_type*;
+		using reference = value_type&;
+
+		// end iterator
+		co_range_iterator(std::nullptr_t) {}
+
+		explicit co_range_iterator(Source* s) : that(s) {}
+
+		co_ready_awaiter<co_range_iterator&> operator++() {
+			if (!that->advance()) {
+				that = nullptr;
+			}
+			return co_ready_awaiter<co_range_iterator&>{*this};
+		}
+
+		bool operator==(co_range_iterator const & rhs) const {
+			return that == rhs.that;
+		}
+		bool operator!=(co_range_iterator const & rhs) const {
+			return !(*this == rhs);
+		}
+
+		value_type& operator*() const {
+			return that->current();
+		}
+		value_type* operator->() const {
+			return std::addressof(that->current());
+		}
+
+		Source* that = nullptr;
+	};
+
+	// a source over a range in memory, with no coroutine frame and no
+	// suspension. an lvalue range is referenced and must outlive the
+	// source, an rvalue range is moved in. elements that are not mutable
+	// lvalues, like those of a const range, a view or a generator, are
+	// copied out one at a time. begin is called once.
+	template<typename Range>
+	struct co_range_source
+	{
+		using range_type = std::remove_reference_t<Range>;
+		using cursor = decltype(std::begin(std::declval<range_type&>()));
+		using sentinel = decltype(std::end(std::declval<range_type&>()));
+		using element = decltype(*std::declval<cursor&>());
+		using value_type = std::remove_cv_t<std::remove_reference_t<element>>;
+		using iterator = co_range_iterator<co_range_source>;
+
+		static constexpr bool copies = !std::is_lvalue_reference<element>::value || std::is_const<std::remove_reference_t<element>>::value;
+
+		explicit co_range_source(Range r) : range(std::forward<Range>(r)) {}
+
+		co_ready_awaiter<iterator> begin() {
+			at.emplace(std::begin(range));
+			last.emplace(std::end(range));
+			if (*at == *last) {
+				return co_ready_awaiter<iterator>{iterator(nullptr)};
+			}
+			load();
+			return co_ready_awaiter<iterator>{iterator(this)};
+		}
+
+		iterator end() const {
+			return iterator(nullptr);
+		}
+
+		bool advance() {
+			if (++*at == *last) {
+				return false;
+			}
+			load();
+			return true;
+		}
+
+		value_type& current() {
+			if constexpr (copies) {
+				return *slot;
+			}
+			else {
+				return **at;
+			}
+		}
+
+	private:
+		void load() {
+			if constexpr (copies) {
+				slot.emplace(**at);
+			}
+		}
+
+		Range range;
+		std::optional<cursor> at;
+		std::optional<sentinel> last;
+		std::optional<value_type> slot;
+	};
+
+	// a source of spans over consecutive runs of up to chunk elements of a
+	// contiguous range. aggregates like sum reduce a span at a time.
+	template<typename Range>
+	struct co_range_chunks
+	{
+		using range_type = std::remove_reference_t<Range>;
+		using element = std::remove_reference_t<decltype(*std::data(std::declval<range_type&>()))>;
+		using value_type = std::span<element>;
+		using iterator = co_range_iterator<co_range_chunks>;
+
+		co_range_chunks(Range r, std::size_t n) : range(std::forward<Range>(r)), chunk(n == 0 ? 1 : n) {}
+
+		co_ready_awaiter<iterator> begin() {
+			offset = 0;
+			if (!load()) {
+				return co_ready_awaiter<iterator>{iterator(nullptr)};
+			}
+			return co_ready_awaiter<iterator>{iterator(this)};
+		}
+
+		iterator end() const {
+			return iterator(nullptr);
+		}
+
+		bool advance() {
+			offset += span.size();
+			return load();
+		}
+
+		value_type& current() {
+			return span;
+		}
+
+	private:
+		bool load() {
+			auto size = static_cast<std::size_t>(std::size(range));
+			if (offset == size) {
+				return false;
+			}
+			span = value_type(std::data(range) + offset, std::min(chunk, size - offset));
+			return true;
+		}
+
+		Range range;
+		std::size_t chunk;
+		std::size_t offset = 0;
+		value_type span;
+	};
+
+	template<typename Range>
+	co_range_source<Range> from_range(Range&& range) {
+		return co_range_source<Range>(std::forward<Range>(range));
+	}
+
+	template<typename Range>
+	co_range_chunks<Range> from_range(Range&& range, std::size_t chunk) {
+		return co_range_chunks<Range>(std::forward<Range>(range), chunk);
+	}
+
+	// a synchronous generator, such as std::generator, is a range that is
+	// walked once. it is owned by the source.
+	template<typename Generator>
+	co_range_source<Generator> from_generator(Generator generator) {
+		return co_range_source<Generator>(std::move(generator));
+	}
+
+	template<typename T, typename Source>
+	co_value_generator<T> any_async_adapt(Source source) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if constexpr (std::is_same<decltype(*it), T&>::value) {
+				co_yield *it;
+			}
+			else {
+				T v(*it);
+				co_yield v;
+			}
+			co_await ++it;
+		}
+	}
+
+	// a source of T of any type. every generator in co_alg is driven through
+	// co_generator_promise<T>, whatever its promise type, so a generator is
+	// held as a pointer to that base and advanced with the same iterator as
+	// a co_value_generator. the only indirect call, other than resuming the
+	// frame, is the one that destroys it. other sources, or sources of
+	// another value type, are first wrapped in a generator that iterates
+	// them, which costs one resume per value, or per chunk for a source of
+	// chunks.
+	template<typename T>
+	class any_async_generator
+	{
+	public:
+		using value_type = T;
+		using iterator = co_iterator<T>;
+
+		any_async_generator() noexcept = default;
+
+		template<typename Source, typename = std::enable_if_t<!std::is_same<std::decay_t<Source>, any_async_generator>::value>,
+			typename = decltype(std::declval<Source&>().begin(), std::declval<Source&>().end())>
+		any_async_generator(Source source) {
+			adopt(std::move(source));
+		}
+
+		any_async_generator(const any_async_generator&) = delete;
+		any_async_generator& operator=(const any_async_generator&) = delete;
+		any_async_generator(any_async_generator&& o) noexcept :
+			p(std::exchange(o.p, nullptr)),
+			destroy(o.destroy)
+		{}
+		any_async_generator& operator=(any_async_generator&& o) noexcept {
+			if (this != std::addressof(o)) {
+				this->~any_async_generator();
+				p = std::exchange(o.p, nullptr);
+				destroy = o.destroy;
+			}
+			return *this;
+		}
+
+		~any_async_generator() noexcept {
+			if (!!p) {
+				destroy(p);
+				p = nullptr;
+			}
+		}
+
+		co_iterator_awaiter<T> begin() const {
+			return co_iterator_awaiter<T>(*p);
+		}
+
+		co_iterator<T> end() const {
+			return co_iterator<T>(nullptr);
+		}
+
+		explicit operator bool() const noexcept {
+			return !!p;
+		}
+
+	private:
+		template<typename P>
+		static void destroy_promise(co_generator_promise<T> const * base) {
+			static_cast<P const *>(base)->destroy();
+		}
+
+		template<typename P, typename = std::enable_if_t<std::is_base_of<co_generator_promise<T>, P>::value>>
+		void adopt(co_generator<P> source) {
+			p = source.release();
+			destroy = &destroy_promise<P>;
+		}
+
+		template<typename Source>
+		void adopt(Source source) {
+			adopt(any_async_adapt<T>(std::move(source)));
+		}
+
+		co_generator_promise<T> const * p = nullptr;
+		void (*destroy)(co_generator_promise<T> const *) = nullptr;
+	};
+
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	any_async_generator<SourceValue> to_any(Source source) {
+		return any_async_generator<SourceValue>(std::move(source));
+	}
+
+	struct replay_stats
+	{
+		// values and bytes currently retained
+		std::size_t retained = 0;
+		std::size_t bytes = 0;
+		std::size_t peak_bytes = 0;
+		// values dropped by the count, the window or the byte budget
+		std::size_t evicted = 0;
+		std::size_t evicted_bytes = 0;
+		// values a subscriber never received because they were evicted
+		// before it got to them, summed over subscribers
+		std::size_t skipped = 0;
+	};
+
+	struct replay_policy
+	{
+		std::size_t count;
+		std::chrono::steady_clock::duration window;
+		std::size_t budget;
+	};
+
+	// the source of a replay is driven by one pump coroutine, not by a
+	// subscriber, so a subscriber can be destroyed at any point without
+	// leaving the source to resume it. the pump pulls while subscribers
+	// wait and parks when none does. it keeps the state alive while it
+	// runs or pulls, and the state destroys it where it is parked.
+	template<typename Source>
+	struct replay_state : std::enable_shared_from_this<replay_state<Source>>
+	{
+		using value_type = typename std::decay_t<Source>::value_type;
+		using iterator = decltype(std::declval<Source&>().end());
+		using clock = std::chrono::steady_clock;
+
+		struct entry
+		{
+			value_type value;
+			clock::time_point at;
+			std::size_t bytes;
+		};
+
+		// a subscriber waits here for the next value, slot is where its
+		// canceler finds the handle while it is queued
+		struct wait_awaiter
+		{
+			replay_state* that;
+			coroutine_handle<>* slot;
+
+			bool await_ready() {
+				return false;
+			}
+			coroutine_handle<> await_suspend(coroutine_handle<> handle) {
+				*slot = handle;
+				that->waiting.push_back(handle);
+				// a parked pump pulls the value
+				if (auto pump = std::exchange(that->pump, nullptr)) {
+					return pump;
+				}
+				return noop_coroutine();
+			}
+			void await_resume() {
+				*slot = nullptr;
+			}
+		};
+
+		// the pump parks here while no subscriber waits. the reference it
+		// holds is released once it is parked, which may destroy the state
+		// and with it the pump, so nothing is touched after that.
+		struct park_awaiter
+		{
+			replay_state* that;
+			std::shared_ptr<replay_state> keep;
+
+			bool await_ready() {
+				return !that->waiting.empty();
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->pump = handle;
+				auto release = std::move(keep);
+			}
+			std::shared_ptr<replay_state> await_resume() {
+				if (keep) {
+					return std::move(keep);
+				}
+				return that->shared_from_this();
+			}
+		};
+
+		replay_state(Source s, replay_policy p) :
+			source(std::move(s)),
+			cursor(source.end()),
+			policy(p)
+		{}
+
+		~replay_state() {
+			if (pump) {
+				pump.destroy();
+			}
+		}
+
+		wait_awaiter wait(coroutine_handle<>& slot) {
+			return wait_awaiter{this, std::addressof(slot)};
+		}
+
+		park_awaiter park(std::shared_ptr<replay_state> keep) {
+			return park_awaiter{this, std::move(keep)};
+		}
+
+		// resumes the subscribers that were waiting when it was called. a
+		// resumed subscriber may wait again, which queues it behind them, or
+		// destroy another one, which removes it from the queue.
+		void wake() {
+			for (auto n = waiting.size(); n != 0 && !waiting.empty(); --n) {
+				auto h = waiting.front();
+				waiting.pop_front();
+				h();
+			}
+		}
+
+		void cancel(coroutine_handle<> handle) {
+			auto found = std::find(waiting.begin(), waiting.end(), handle);
+			if (found != waiting.end()) {
+				waiting.erase(found);
+			}
+		}
+
+		void push(value_type const & v) {
+			auto at = policy.window == clock::duration::max() ? clock::time_point() : clock::now();
+			auto bytes = co_size_of<value_type>()(v);
+			expire();
+			ring.push_back(entry{v, at, bytes});
+			stats.retained = ring.size();
+			stats.bytes += bytes;
+			if (stats.bytes > stats.peak_bytes) {
+				stats.peak_bytes = stats.bytes;
+			}
+			// the newest value is always kept so that waiting subscribers see it
+			while (ring.size() > 1 && (ring.size() > policy.count || stats.bytes > policy.budget)) {
+				evict();
+			}
+		}
+
+		void expire() {
+			if (policy.window == clock::duration::max() || ring.empty()) {
+				return;
+			}
+			auto horizon = clock::now() - policy.window;
+			while (!ring.empty() && ring.front().at < horizon) {
+				evict();
+			}
+		}
+
+		void evict() {
+			auto bytes = ring.front().bytes;
+			ring.pop_front();
+			++first;
+			stats.retained = ring.size();
+			stats.bytes -= bytes;
+			++stats.evicted;
+			stats.evicted_bytes += bytes;
+		}
+
+		Source source;
+		iterator cursor;
+		replay_policy policy;
+		co_ring<entry> ring;
+		// sequence number of ring.front()
+		std::uint64_t first = 0;
+		replay_stats stats;
+		bool started = false;
+		bool completed = false;
+		std::exception_ptr error;
+		std::deque<coroutine_handle<>> waiting;
+		// set while the pump is parked
+		coroutine_handle<> pump;
+	};
+
+	template<typename Source>
+	co_detached replay_pump(std::shared_ptr<replay_state<Source>> keep) {
+		auto state = keep.get();
+		keep = co_await state->park(std::move(keep));
+		for (;;) {
+			try
+			{
+				if (!state->started) {
+					state->started = true;
+					state->cursor = co_await state->source.begin();
+				}
+				else {
+					co_await ++state->cursor;
+				}
+			}
+			catch (...)
+			{
+				state->error = std::current_exception();
+				state->cursor = state->source.end();
+			}
+			if (state->cursor == state->source.end()) {
+				state->completed = true;
+				state->wake();
+				break;
+			}
+			state->push(*state->cursor);
+			state->wake();
+			keep = co_await state->park(std::move(keep));
+		}
+	}
+
+	// takes a destroyed subscriber out of the queue of waiting subscribers
+	template<typename Source>
+	struct replay_canceler
+	{
+		std::shared_ptr<replay_state<Source>> state;
+		coroutine_handle<> waiting;
+		~replay_canceler() {
+			if (waiting) {
+				state->cancel(waiting);
+			}
+		}
+	};
+
+	template<typename Source, typename SourceValue = typename replay_state<Source>::value_type>
+	co_value_generator<SourceValue> replay_subscriber(std::shared_ptr<replay_state<Source>> state) {
+		replay_canceler<Source> canceler{state, nullptr};
+		// the window applies to what a late subscriber replays, live values are not expired
+		state->expire();
+		auto next = state->first;
+		for (;;) {
+			if (next < state->first) {
+				// fell behind the retained values, the gap is counted
+				state->stats.skipped += static_cast<std::size_t>(state->first - next);
+				next = state->first;
+			}
+			if (next != state->first + state->ring.size()) {
+				auto v = state->ring[static_cast<std::size_t>(next - state->first)].value;
+				++next;
+				co_yield v;
+			}
+			else if (state->completed) {
+				break;
+			}
+			else {
+				co_await state->wait(canceler.waiting);
+			}
+		}
+		if (state->error) {
+			std::rethrow_exception(state->error);
+		}
+	}
+
+	// shares one run of the source between any number of subscribers. each
+	// subscriber first receives the retained values and then the live ones.
+	// the buffer is shared, so a subscriber that falls further behind than
+	// the policy retains continues from the oldest retained value and the
+	// values it missed are counted in stats().skipped.
+	template<typename Source>
+	struct co_replay
+	{
+		using value_type = typename replay_state<Source>::value_type;
+
+		co_value_generator<value_type> subscribe() const {
+			return replay_subscriber(state);
+		}
+
+		replay_stats stats() const {
+			return state->stats;
+		}
+
+		std::shared_ptr<replay_state<Source>> state;
+	};
+
+	template<typename Source>
+	co_replay<std::decay_t<Source>> replay(Source&& source, replay_policy policy) {
+		if (policy.count == 0) {
+			// the newest value is always retained for waiting subscribers
+			throw std::invalid_argument("replay: count must be at least 1");
+		}
+		auto state = std::make_shared<replay_state<std::decay_t<Source>>>(std::forward<Source>(source), policy);
+		replay_pump(state);
+		return co_replay<std::decay_t<Source>>{std::move(state)};
+	}
+
+	// restores the heap order after heap[0] was replaced. this costs one
+	// pass down the heap where pop_heap followed by push_heap costs two.
+	template<typename Head, typename Later>
+	void merge_sorted_sift(std::vector<Head>& heap, Later later) {
+		std::size_t i = 0;
+		for (;;) {
+			auto c = 2 * i + 1;
+			if (c >= heap.size()) {
+				break;
+			}
+			if (c + 1 < heap.size() && later(heap[c], heap[c + 1])) {
+				++c;
+			}
+			if (!later(heap[i], heap[c])) {
+				break;
+			}
+			std::swap(heap[i], heap[c]);
+			i = c;
+		}
+	}
+
+	template<typename Source, typename Key, typename Compare, typename Inner = typename std::decay_t<Source>::value_type, typename SourceValue = typename Inner::value_type>
+	co_value_generator<SourceValue> merge_sorted(Source source, Key key, Compare compare) {
+		using key_type = std::decay_t<decltype(key(std::declval<SourceValue const &>()))>;
+		using iterator = decltype(std::declval<Inner&>().end());
+		struct head
+		{
+			key_type key;
+			iterator it;
+		};
+		auto later = [&](head const & l, head const & r) {
+			return compare(r.key, l.key);
+		};
+
+		// the order is only known once every inner stream has produced its head
+		std::vector<Inner> inners;
+		auto s = co_await source.begin();
+		while (s != source.end()) {
+			inners.push_back(std::move(*s));
+			co_await ++s;
+		}
+
+		std::vector<head> heap;
+		heap.reserve(inners.size());
+		for (auto& inner : inners) {
+			auto it = co_await inner.begin();
+			if (it != inner.end()) {
+				heap.push_back(head{key(*it), it});
+			}
+		}
+		std::make_heap(heap.begin(), heap.end(), later);
+
+		while (!heap.empty()) {
+			co_yield *heap.front().it;
+			auto& top = heap.front();
+			co_await ++top.it;
+			if (top.it == iterator(nullptr)) {
+				top = std::move(heap.back());
+				heap.pop_back();
+			}
+			else {
+				top.key = key(*top.it);
+			}
+			merge_sorted_sift(heap, later);
+		}
+	}
+
+	// batched form for inner streams of sorted chunks (a sorted stream split
+	// into containers). values are copied out in merged order and emitted in
+	// vectors of up to batch values.
+	template<typename Source, typename Key, typename Compare, typename Inner = typename std::decay_t<Source>::value_type, typename Chunk = typename Inner::value_type, typename ChunkValue = std::decay_t<decltype(*std::begin(std::declval<Chunk&>()))>>
+	co_value_generator<std::vector<ChunkValue>> merge_sorted(Source source, Key key, Compare compare, std::size_t batch) {
+		using key_type = std::decay_t<decltype(key(std::declval<ChunkValue const &>()))>;
+		using iterator = decltype(std::declval<Inner&>().end());
+		using cursor = decltype(std::begin(std::declval<Chunk&>()));
+		struct head
+		{
+			key_type key;
+			iterator it;
+			cursor at;
+		};
+		auto later = [&](head const & l, head const & r) {
+			return compare(r.key, l.key);
+		};
+
+		std::vector<Inner> inners;
+		auto s = co_await source.begin();
+		while (s != source.end()) {
+			inners.push_back(std::move(*s));
+			co_await ++s;
+		}
+
+		std::vector<head> heap;
+		heap.reserve(inners.size());
+		for (auto& inner : inners) {
+			auto it = co_await inner.begin();
+			while (it != inner.end() && std::begin(*it) == std::end(*it)) {
+				co_await ++it;
+			}
+			if (it != inner.end()) {
+				auto at = std::begin(*it);
+				heap.push_back(head{key(*at), it, at});
+			}
+		}
+		std::make_heap(heap.begin(), heap.end(), later);
+
+		std::vector<ChunkValue> out;
+		out.reserve(batch);
+		while (!heap.empty()) {
+			auto& top = heap.front();
+			out.push_back(*top.at);
+			if (++top.at == std::end(*top.it)) {
+				// the chunk is consumed, it may be released by advancing
+				do {
+					co_await ++top.it;
+				} while (top.it != iterator(nullptr) && std::begin(*top.it) == std::end(*top.it));
+				if (top.it != iterator(nullptr)) {
+					top.at = std::begin(*top.it);
+				}
+			}
+			if (top.it == iterator(nullptr)) {
+				top = std::move(heap.back());
+				heap.pop_back();
+			}
+			else {
+				top.key = key(*top.at);
+			}
+			merge_sorted_sift(heap, later);
+			if (out.size() == batch || (heap.empty() && !out.empty())) {
+				co_yield out;
+				out.clear();
+			}
+		}
+	}
+
+	template<typename Inner>
+	struct concat_prefetch
+	{
+		using value_type = typename std::decay_t<Inner>::value_type;
+		using iterator = decltype(std::declval<Inner&>().end());
+
+		struct wait_awaiter
+		{
+			concat_prefetch* that;
+
+			bool await_ready() {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->waiter = handle;
+			}
+			void await_resume() {
+			}
+		};
+
+		concat_prefetch(Inner s, std::size_t l) :
+			source(std::move(s)),
+			it(source.end()),
+			limit(l)
+		{}
+
+		wait_awaiter wait() {
+			return wait_awaiter{this};
+		}
+
+		void wake() {
+			auto w = waiter;
+			waiter = nullptr;
+			if (w) {
+				w();
+			}
+		}
+
+		// the prefetcher returns once its source resumes it
+		void cancel() {
+			canceled = true;
+			waiter = nullptr;
+		}
+
+		Inner source;
+		// after the prefetch, it refers to the last buffered value or is the end
+		iterator it;
+		std::size_t limit;
+		co_ring<value_type> buffer;
+		bool busy = true;
+		bool canceled = false;
+		std::exception_ptr error;
+		coroutine_handle<> waiter;
+	};
+
+	// stops the prefetchers when concat completes or is destroyed
+	template<typename Inner>
+	struct concat_canceler
+	{
+		std::deque<std::shared_ptr<concat_prefetch<Inner>>>& ahead;
+		std::shared_ptr<concat_prefetch<Inner>>& current;
+		~concat_canceler() {
+			for (auto& state : ahead) {
+				state->cancel();
+			}
+			if (current) {
+				current->cancel();
+			}
+		}
+	};
+
+	// starts an inner stream before concat reaches it and buffers up to
+	// limit leading values, so the startup latency overlaps the previous one
+	template<typename Inner>
+	co_detached concat_prefetcher(std::shared_ptr<concat_prefetch<Inner>> state) {
+		try
+		{
+			state->it = co_await state->source.begin();
+			while (state->it != state->source.end() && !state->canceled) {
+				state->buffer.push_back(*state->it);
+				if (state->buffer.size() >= state->limit) {
+					break;
+				}
+				state->wake();
+				co_await ++state->it;
+			}
+		}
+		catch (...)
+		{
+			state->error = std::current_exception();
+		}
+		state->busy = false;
+		state->wake();
+	}
+
+	template<typename Source, typename Inner = typename std::decay_t<Source>::value_type, typename SourceValue = typename Inner::value_type>
+	co_value_generator<SourceValue> concat(Source source, std::size_t prefetch, std::size_t buffer) {
+		std::deque<std::shared_ptr<concat_prefetch<Inner>>> ahead;
+		std::shared_ptr<concat_prefetch<Inner>> current;
+		concat_canceler<Inner> canceler{ahead, current};
+		auto s = co_await source.begin();
+		for (;;) {
+			// the current inner stream and up to prefetch more are started
+			while (s != source.end() && ahead.size() <= prefetch) {
+				auto state = std::make_shared<concat_prefetch<Inner>>(std::move(*s), buffer);
+				concat_prefetcher(state);
+				ahead.push_back(std::move(state));
+				co_await ++s;
+			}
+			if (ahead.empty()) {
+				break;
+			}
+			current = std::move(ahead.front());
+			ahead.pop_front();
+			for (;;) {
+				while (!current->buffer.empty()) {
+					auto v = std::move(current->buffer.front());
+					current->buffer.pop_front();
+					co_yield v;
+				}
+				if (!current->busy) {
+					break;
+				}
+				co_await current->wait();
+			}
+			if (current->error) {
+				std::rethrow_exception(current->error);
+			}
+			// the buffered values are emitted, continue the stream in place
+			if (current->it != current->source.end()) {
+				co_await ++current->it;
+				while (current->it != current->source.end()) {
+					co_yield *current->it;
+					co_await ++current->it;
+				}
+			}
+		}
+	}
+
+	// one source of zip or combine_latest. a pump moves its values into the
+	// ring and parks once the ring holds capacity values, so a fast source
+	// waits for the slow ones instead of growing its buffer.
+	template<typename Source>
+	struct zip_lane
+	{
+		using value_type = typename std::decay_t<Source>::value_type;
+
+		struct park_awaiter
+		{
+			zip_lane* that;
+
+			bool await_ready() {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->parked = handle;
+			}
+			void await_resume() {
+			}
+		};
+
+		zip_lane(Source s, std::size_t c) :
+			source(std::move(s)),
+			capacity(c),
+			ring(c)
+		{}
+
+		park_awaiter park() {
+			return park_awaiter{this};
+		}
+
+		void unpark() {
+			auto p = parked;
+			parked = nullptr;
+			if (p) {
+				p();
+			}
+		}
+
+		Source source;
+		std::size_t capacity;
+		co_ring<value_type> ring;
+		// the last value combine_latest took from the ring
+		std::optional<value_type> latest;
+		coroutine_handle<> parked;
+		bool completed = false;
+		std::exception_ptr error;
+	};
+
+	template<typename... Sources>
+	struct zip_state
+	{
+		using value_type = std::tuple<typename zip_lane<Sources>::value_type...>;
+
+		struct wait_awaiter
+		{
+			zip_state* that;
+
+			bool await_ready() {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->waiter = handle;
+			}
+			void await_resume() {
+			}
+		};
+
+		zip_state(std::size_t capacity, Sources... s) :
+			lanes(zip_lane<Sources>(std::move(s), capacity)...)
+		{}
+
+		wait_awaiter wait() {
+			return wait_awaiter{this};
+		}
+
+		void wake() {
+			auto w = waiter;
+			waiter = nullptr;
+			if (w) {
+				w();
+			}
+		}
+
+		template<typename F>
+		void each(F f) {
+			std::apply([&](auto&... lane) { (f(lane), ...); }, lanes);
+		}
+		template<typename F>
+		bool all(F f) {
+			return std::apply([&](auto&... lane) { return (f(lane) && ...); }, lanes);
+		}
+		template<typename F>
+		bool any(F f) {
+			return std::apply([&](auto&... lane) { return (f(lane) || ...); }, lanes);
+		}
+
+		// an error follows the values the lane buffered before it
+		void rethrow() {
+			each([](auto& lane) {
+				if (lane.error && lane.ring.empty()) {
+					std::rethrow_exception(lane.error);
+				}
+			});
+		}
+
+		// passes the next buffered value to f(index, lane), starting with the
+		// lane after the one served last. false when no lane has a value.
+		template<typename F>
+		bool take(std::size_t& turn, F f) {
+			for (std::size_t k = 0; k < sizeof...(Sources); ++k) {
+				auto target = (turn + k) % sizeof...(Sources);
+				if (take_from(target, f, std::index_sequence_for<Sources...>())) {
+					turn = target + 1;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		template<typename F, std::size_t... I>
+		bool take_from(std::size_t target, F& f, std::index_sequence<I...>) {
+			bool took = false;
+			auto visit = [&](auto index) {
+				auto& lane = std::get<decltype(index)::value>(lanes);
+				if (index == target && !lane.ring.empty()) {
+					f(index, lane);
+					lane.ring.pop_front();
+					lane.unpark();
+					took = true;
+				}
+			};
+			(visit(std::integral_constant<std::size_t, I>()), ...);
+			return took;
+		}
+
+		// parked pumps return, pumps waiting on their source return when it resumes them
+		void cancel() {
+			canceled = true;
+			waiter = nullptr;
+			each([](auto& lane) {
+				lane.unpark();
+			});
+		}
+
+		std::tuple<zip_lane<Sources>...> lanes;
+		coroutine_handle<> waiter;
+		bool canceled = false;
+	};
+
+	template<typename State, typename Lane>
+	co_detached zip_pump(std::shared_ptr<State> state, Lane& lane) {
+		try
+		{
+			auto it = co_await lane.source.begin();
+			while (it != lane.source.end() && !state->canceled) {
+				lane.ring.push_back(*it);
+				state->wake();
+				if (lane.ring.size() >= lane.capacity && !state->canceled) {
+					co_await lane.park();
+				}
+				if (state->canceled) {
+					break;
+				}
+				co_await ++it;
+			}
+		}
+		catch (...)
+		{
+			lane.error = std::current_exception();
+		}
+		lane.completed = true;
+		state->wake();
+	}
+
+	// stops the pumps when the operator that started them completes or is destroyed
+	template<typename State>
+	struct zip_canceler
+	{
+		std::shared_ptr<State> state;
+		~zip_canceler() {
+			state->cancel();
+		}
+	};
+
+	template<typename State>
+	zip_canceler<State> zip_start(std::shared_ptr<State> const & state) {
+		state->each([&](auto& lane) {
+			zip_pump(state, lane);
+		});
+		return zip_canceler<State>{state};
+	}
+
+	// pairs the values of the sources by position and completes with the
+	// shortest source. each source runs up to buffer values ahead of the
+	// slowest one.
+	template<typename... Sources>
+	co_value_generator<typename zip_state<Sources...>::value_type> zip(std::size_t buffer, Sources... sources) {
+		using state_type = zip_state<Sources...>;
+		auto state = std::make_shared<state_type>(std::max<std::size_t>(buffer, 1), std::move(sources)...);
+		auto canceler = zip_start(state);
+		for (;;) {
+			state->rethrow();
+			if (state->all([](auto& lane) { return !lane.ring.empty(); })) {
+				auto t = std::apply([](auto&... lane) {
+					return typename state_type::value_type(std::move(lane.ring.front())...);
+				}, state->lanes);
+				state->each([](auto& lane) {
+					lane.ring.pop_front();
+					lane.unpark();
+				});
+				co_yield t;
+			}
+			else if (state->any([](auto& lane) { return lane.ring.empty() && lane.completed; })) {
+				break;
+			}
+			else {
+				co_await state->wait();
+			}
+		}
+	}
+
+	template<typename Source, typename... Sources, typename = std::enable_if_t<!std::is_integral<Source>::value>>
+	co_value_generator<typename zip_state<Source, Sources...>::value_type> zip(Source source, Sources... sources) {
+		return zip(4, std::move(source), std::move(sources)...);
+	}
+
+	// emits the latest value of every source each time one of them produces
+	// a value, once all of them have produced one. a source holds one value
+	// until it has been combined, and the sources are served in turn so a
+	// fast one cannot starve the others. completes when every source has
+	// completed, or when one completes without producing a value.
+	template<typename... Sources>
+	co_value_generator<typename zip_state<Sources...>::value_type> combine_latest(Sources... sources) {
+		using state_type = zip_state<Sources...>;
+		auto state = std::make_shared<state_type>(1, std::move(sources)...);
+		auto canceler = zip_start(state);
+		std::size_t turn = 0;
+		for (;;) {
+			state->rethrow();
+			auto took = state->take(turn, [](auto, auto& lane) {
+				lane.latest = std::move(lane.ring.front());
+			});
+			if (took) {
+				if (state->all([](auto& lane) { return !!lane.latest; })) {
+					auto t = std::apply([](auto&... lane) {
+						return typename state_type::value_type(*lane.latest...);
+					}, state->lanes);
+					co_yield t;
+				}
+			}
+			else if (state->all([](auto& lane) { return lane.completed; }) ||
+				state->any([](auto& lane) { return lane.completed && !lane.latest; })) {
+				break;
+			}
+			else {
+				co_await state->wait();
+			}
+		}
+	}
+
+#if defined(CO_ALG_TRACE)
+
+	// ends a sample when trace_source's value is abandoned, because the
+	// pipeline was destroyed or the value was buffered out of its chain
+	struct trace_source_guard
+	{
+		~trace_source_guard() {
+			if (context && co_trace_context::current() == context) {
+				co_trace_context::current() = previous;
+				if (context->active && context->id == id) {
+					context->trace->abandon(context);
+				}
+			}
+		}
+
+		co_trace_context* context = nullptr;
+		std::uint64_t id = 0;
+		co_trace_context* previous = nullptr;
+	};
+
+	// starts a trace for one value in every of the trace
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> trace_source(Source source, std::shared_ptr<co_trace> trace) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			if (trace->sample()) {
+				trace_source_guard guard;
+				guard.context = trace->start();
+				guard.id = guard.context->id;
+				guard.previous = std::exchange(co_trace_context::current(), guard.context);
+				co_yield *it;
+			}
+			else {
+				co_yield *it;
+			}
+			co_await ++it;
+		}
+	}
+
+	// completes the sample of trace that arrives with a value
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> trace_sink(Source source, std::shared_ptr<co_trace> trace) {
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			auto c = co_trace_context::current();
+			if (c && c->active && c->trace == trace.get()) {
+				co_trace_context::current() = nullptr;
+				trace->finish(c);
+			}
+			co_yield *it;
+			co_await ++it;
+		}
+	}
+
+#endif
+
+	// what on_backpressure sheds when the consumer falls behind
+	enum class backpressure
+	{
+		// the oldest buffered value makes room for the new one
+		drop_oldest,
+		// the new value is dropped while the buffer is full
+		drop_newest,
+		// only the newest value is kept, the capacity is 1
+		latest,
+		// once the buffer is half full new values are admitted with a
+		// probability that falls to zero as it fills, so the values that
+		// are dropped are spread over the stream instead of bunched
+		sample
+	};
+
+	struct backpressure_stats
+	{
+		// values taken from the source and values passed to the consumer
+		std::size_t received = 0;
+		std::size_t delivered = 0;
+		// values shed by the policy
+		std::size_t dropped = 0;
+		// most values buffered at once
+		std::size_t peak = 0;
+	};
+
+	template<typename Source>
+	struct backpressure_state
+	{
+		using value_type = typename std::decay_t<Source>::value_type;
+
+		struct wait_awaiter
+		{
+			backpressure_state* that;
+
+			bool await_ready() {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->waiter = handle;
+			}
+			void await_resume() {
+			}
+		};
+
+		backpressure_state(Source s, backpressure a, std::size_t c, std::shared_ptr<backpressure_stats> st) :
+			source(std::move(s)),
+			action(a),
+			capacity(a == backpressure::latest ? 1 : std::max<std::size_t>(c, 1)),
+			ring(capacity),
+			stats(st ? std::move(st) : std::make_shared<backpressure_stats>())
+		{}
+
+		wait_awaiter wait() {
+			return wait_awaiter{this};
+		}
+
+		void wake() {
+			auto w = waiter;
+			waiter = nullptr;
+			if (w) {
+				w();
+			}
+		}
+
+		void push(value_type const & v) {
+			++stats->received;
+			if (ring.size() >= capacity) {
+				++stats->dropped;
+				if (action == backpressure::drop_newest || action == backpressure::sample) {
+					return;
+				}
+				ring.pop_front();
+			}
+			else if (action == backpressure::sample && !admit()) {
+				++stats->dropped;
+				return;
+			}
+			ring.push_back(v);
+			stats->peak = std::max(stats->peak, ring.size());
+		}
+
+		bool admit() {
+			auto half = capacity / 2;
+			if (ring.size() < half || capacity - half == 0) {
+				return true;
+			}
+			// splitmix64, the top 53 bits as a fraction of one
+			auto h = (seed += 0x9E3779B97F4A7C15ull);
+			h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+			h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+			h ^= h >> 31;
+			auto room = static_cast<double>(capacity - ring.size()) / static_cast<double>(capacity - half);
+			return static_cast<double>(h >> 11) * 0x1.0p-53 < room;
+		}
+
+		// the pump returns once its source resumes it
+		void cancel() {
+			canceled = true;
+			waiter = nullptr;
+		}
+
+		Source source;
+		backpressure action;
+		std::size_t capacity;
+		co_ring<value_type> ring;
+		std::shared_ptr<backpressure_stats> stats;
+		std::uint64_t seed = 0;
+		coroutine_handle<> waiter;
+		bool completed = false;
+		bool canceled = false;
+		std::exception_ptr error;
+	};
+
+	// pulls the source as fast as it produces, never waiting for the consumer
+	template<typename State>
+	co_detached backpressure_pump(std::shared_ptr<State> state) {
+		try
+		{
+			auto it = co_await state->source.begin();
+			while (it != state->source.end() && !state->canceled) {
+				state->push(*it);
+				state->wake();
+				if (state->canceled) {
+					break;
+				}
+				co_await ++it;
+			}
+		}
+		catch (...)
+		{
+			state->error = std::current_exception();
+		}
+		state->completed = true;
+		state->wake();
+	}
+
+	// decouples the source from a consumer that falls behind. the source is
+	// pulled as soon as it can produce, into a ring of capacity values, and
+	// the action decides what is shed when the ring is full, so the memory
+	// held and the age of the values delivered stay bounded. a source that
+	// completes without suspending is drained before the consumer sees a
+	// value. stats, when given, is updated as values pass.
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> on_backpressure(Source source, backpressure action, std::size_t capacity, std::shared_ptr<backpressure_stats> stats = nullptr) {
+		using state_type = backpressure_state<Source>;
+		auto state = std::make_shared<state_type>(std::move(source), action, capacity, std::move(stats));
+		zip_canceler<state_type> canceler{state};
+		backpressure_pump(state);
+		for (;;) {
+			if (!state->ring.empty()) {
+				auto v = std::move(state->ring.front());
+				state->ring.pop_front();
+				++state->stats->delivered;
+				co_yield v;
+			}
+			else if (state->completed) {
+				if (state->error) {
+					std::rethrow_exception(state->error);
+				}
+				break;
+			}
+			else {
+				co_await state->wait();
+			}
+		}
+	}
+
+	// the values of one side of join_within in arrival order. the values
+	// with equal keys are chained through next, and the index holds the
+	// first and last of each chain. the oldest value is always the head of
+	// its chain, so expiring values pops them off the front without a scan.
+	template<typename Key, typename Value>
+	struct join_side
+	{
+		using clock = std::chrono::steady_clock;
+
+		static constexpr std::uint64_t none = UINT64_MAX;
+
+		struct entry
+		{
+			Key key;
+			Value value;
+			clock::time_point at;
+			std::uint64_t next;
+		};
+
+		struct chain
+		{
+			std::uint64_t head = none;
+			std::uint64_t tail = none;
+		};
+
+		void insert(Key key, Value value, clock::time_point at) {
+			auto seq = first + entries.size();
+			auto inserted = index.insert(key, chain{seq, seq});
+			if (!inserted.second) {
+				entry_at(inserted.first->tail).next = seq;
+				inserted.first->tail = seq;
+			}
+			entries.push_back(entry{std::move(key), std::move(value), at, none});
+		}
+
+		// drops the values that arrived before horizon
+		void expire(clock::time_point horizon) {
+			while (!entries.empty() && entries.front().at < horizon) {
+				auto& e = entries.front();
+				if (e.next == none) {
+					index.erase(e.key);
+				}
+				else {
+					index.find(e.key)->head = e.next;
+				}
+				entries.pop_front();
+				++first;
+			}
+		}
+
+		std::uint64_t head(Key const & key) {
+			auto c = index.find(key);
+			return c ? c->head : none;
+		}
+
+		entry& entry_at(std::uint64_t seq) {
+			return entries[static_cast<std::size_t>(seq - first)];
+		}
+
+		co_ring<entry> entries;
+		// sequence number of entries.front()
+		std::uint64_t first = 0;
+		co_flat_map<Key, chain> index;
+	};
+
+	// pairs each value with the values of the other side that have an equal
+	// key and arrived at most window earlier. a pair is emitted as soon as
+	// its second value arrives, left value first. the values held are
+	// dropped in bulk once every half window, so memory is bounded by the
+	// values that arrive within one and a half windows.
+	template<typename Left, typename Right, typename LeftKey, typename RightKey,
+		typename LeftValue = typename std::decay_t<Left>::value_type, typename RightValue = typename std::decay_t<Right>::value_type,
+		typename Key = std::decay_t<std::invoke_result_t<LeftKey&, LeftValue const &>>>
+	co_value_generator<std::pair<LeftValue, RightValue>> join_within(Left left, Right right, LeftKey left_key, RightKey right_key, std::chrono::steady_clock::duration window) {
+		using clock = std::chrono::steady_clock;
+		using state_type = zip_state<Left, Right>;
+		using pair_type = std::pair<LeftValue, RightValue>;
+		auto state = std::make_shared<state_type>(1, std::move(left), std::move(right));
+		auto canceler = zip_start(state);
+		join_side<Key, LeftValue> lefts;
+		join_side<Key, RightValue> rights;
+		auto sweep = clock::now() + window / 2;
+		std::size_t turn = 0;
+		std::optional<LeftValue> l;
+		std::optional<RightValue> r;
+		for (;;) {
+			state->rethrow();
+			auto took = state->take(turn, [&](auto index, auto& lane) {
+				if constexpr (decltype(index)::value == 0) {
+					l = std::move(lane.ring.front());
+				}
+				else {
+					r = std::move(lane.ring.front());
+				}
+			});
+			if (!took) {
+				if (state->all([](auto& lane) { return lane.completed; })) {
+					break;
+				}
+				co_await state->wait();
 				continue;
 			}
-			--count;
+			auto now = clock::now();
+			auto horizon = now - window;
+			if (now >= sweep) {
+				sweep = now + window / 2;
+				lefts.expire(horizon);
+				rights.expire(horizon);
+			}
+			// the chains are only changed by this coroutine, so they stay
+			// valid while a pair is with the consumer
+			if (l) {
+				Key key = left_key(std::cref(*l).get());
+				for (auto seq = rights.head(key); seq != rights.none; seq = rights.entry_at(seq).next) {
+					auto& e = rights.entry_at(seq);
+					if (e.at >= horizon) {
+						pair_type p(*l, e.value);
+						co_yield p;
+					}
+				}
+				lefts.insert(std::move(key), std::move(*l), now);
+				l.reset();
+			}
+			else {
+				Key key = right_key(std::cref(*r).get());
+				for (auto seq = lefts.head(key); seq != lefts.none; seq = lefts.entry_at(seq).next) {
+					auto& e = lefts.entry_at(seq);
+					if (e.at >= horizon) {
+						pair_type p(e.value, *r);
+						co_yield p;
+					}
+				}
+				rights.insert(std::move(key), std::move(*r), now);
+				r.reset();
+			}
 		}
 	}
 
-	template<typename Exception, typename Source, typename Selector, typename SourceValue = std::decay_t<Source>::value_type>
-	co_value_generator<SourceValue> resume_error(Source source, Selector select) {
-		Exception e;
-		bool error = false;
-		try 
+	// a coroutine that waits on a group_by source, either the stream of
+	// groups or the values of one group
+	struct group_by_party
+	{
+		coroutine_handle<> waiter;
+	};
+
+	template<typename Key, typename T>
+	struct group_by_group : group_by_party
+	{
+		group_by_group(Key k) : key(std::move(k)) {}
+
+		Key key;
+		co_ring<T> queue;
+		std::chrono::steady_clock::time_point last;
+		bool emitted = false;
+		bool expired = false;
+	};
+
+	// the source of group_by is driven by one pump coroutine, which pulls
+	// while a party waits and parks when none does, so a party can be
+	// destroyed at any point without leaving the source to resume it. the
+	// pump keeps the state alive while it runs or pulls, and the state
+	// destroys it where it is parked.
+	template<typename Source, typename KeySelector>
+	struct group_by_state : std::enable_shared_from_this<group_by_state<Source, KeySelector>>
+	{
+		using value_type = typename std::decay_t<Source>::value_type;
+		using key_type = std::decay_t<decltype(std::declval<KeySelector&>()(std::declval<value_type const &>()))>;
+		using group = group_by_group<key_type, value_type>;
+		using iterator = decltype(std::declval<Source&>().end());
+		using clock = std::chrono::steady_clock;
+
+		struct wait_awaiter
 		{
-			for co_await (auto&& v : source) {
-				co_yield v;
+			group_by_state* that;
+			group_by_party* party;
+
+			bool await_ready() {
+				return false;
 			}
-		}
-		catch (const Exception& ex) 
+			coroutine_handle<> await_suspend(coroutine_handle<> handle) {
+				party->waiter = handle;
+				++that->waiters;
+				// a parked pump pulls the next value
+				if (auto pump = std::exchange(that->pump, nullptr)) {
+					return pump;
+				}
+				return noop_coroutine();
+			}
+			void await_resume() {
+			}
+		};
+
+		// the pump parks here while no party waits. the reference it holds
+		// is released once it is parked, which may destroy the state and
+		// with it the pump, so nothing is touched after that.
+		struct park_awaiter
 		{
-			e = ex;
-			error = true;
+			group_by_state* that;
+			std::shared_ptr<group_by_state> keep;
+
+			bool await_ready() {
+				return that->waiters != 0;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				that->pump = handle;
+				auto release = std::move(keep);
+			}
+			std::shared_ptr<group_by_state> await_resume() {
+				if (keep) {
+					return std::move(keep);
+				}
+				return that->shared_from_this();
+			}
+		};
+
+		group_by_state(Source s, KeySelector k, clock::duration i) :
+			source(std::move(s)),
+			cursor(source.end()),
+			select(std::move(k)),
+			idle(i),
+			sweep(clock::now() + (i == clock::duration::max() ? clock::duration::zero() : i))
+		{}
+
+		~group_by_state() {
+			if (pump) {
+				pump.destroy();
+			}
 		}
-		if (error) {
-			auto s = select(e);
-			for co_await (auto&& v : s) {
-				co_yield v;
+
+		wait_awaiter wait(group_by_party& party) {
+			return wait_awaiter{this, std::addressof(party)};
+		}
+
+		park_awaiter park(std::shared_ptr<group_by_state> keep) {
+			return park_awaiter{this, std::move(keep)};
+		}
+
+		void wake(group_by_party& party) {
+			auto w = party.waiter;
+			party.waiter = nullptr;
+			if (w) {
+				--waiters;
+				w();
 			}
 		}
-	}
 
-	template<typename T>
-	co_value_generator<T> empty() {
+		// called for a party that is destroyed
+		void cancel(group_by_party& party) {
+			if (party.waiter) {
+				party.waiter = nullptr;
+				--waiters;
+			}
+		}
+
+		void fail(std::exception_ptr ep) {
+			error = ep;
+			cursor = source.end();
+		}
+
+		// called by the pump for each value it pulled
+		void route() {
+			if (cursor == source.end()) {
+				completed = true;
+				std::vector<std::shared_ptr<group>> open;
+				groups.for_each([&](key_type const &, std::shared_ptr<group>& g) {
+					open.push_back(g);
+				});
+				wake(*outer);
+				for (auto& g : open) {
+					wake(*g);
+				}
+				return;
+			}
+			auto& v = *cursor;
+			auto key = select(std::cref(v).get());
+			auto now = idle == clock::duration::max() ? clock::time_point() : clock::now();
+			if (now >= sweep && idle != clock::duration::max()) {
+				expire(now);
+			}
+			auto inserted = groups.insert(key, nullptr);
+			auto& g = *inserted.first;
+			if (inserted.second) {
+				// groups are created by the first value with a new key
+				g = std::make_shared<group>(std::move(key));
+				fresh.push_back(g);
+			}
+			g->last = now;
+			// an emitted group that nobody holds anymore can never be read
+			if (!g->emitted || g.use_count() > 1) {
+				g->queue.push_back(v);
+				auto target = g;
+				wake(*target);
+			}
+			if (inserted.second) {
+				wake(*outer);
+			}
+		}
+
+		void expire(clock::time_point now) {
+			sweep = now + idle / 2;
+			std::vector<key_type> idled;
+			groups.for_each([&](key_type const & k, std::shared_ptr<group>& g) {
+				if (now - g->last >= idle) {
+					idled.push_back(k);
+				}
+			});
+			for (auto& k : idled) {
+				auto g = *groups.find(k);
+				groups.erase(k);
+				g->expired = true;
+				wake(*g);
+			}
+		}
+
+		Source source;
+		iterator cursor;
+		KeySelector select;
+		clock::duration idle;
+		clock::time_point sweep;
+		co_flat_map<key_type, std::shared_ptr<group>> groups;
+		// groups created but not yet emitted
+		co_ring<std::shared_ptr<group>> fresh;
+		std::shared_ptr<group_by_party> outer = std::make_shared<group_by_party>();
+		// parties that wait for a value
+		std::size_t waiters = 0;
+		// set while the pump is parked
+		coroutine_handle<> pump;
+		bool started = false;
+		bool completed = false;
+		std::exception_ptr error;
+	};
+
+	template<typename State>
+	co_detached group_by_pump(std::shared_ptr<State> keep) {
+		auto state = keep.get();
+		keep = co_await state->park(std::move(keep));
+		for (;;) {
+			try
+			{
+				if (!state->started) {
+					state->started = true;
+					state->cursor = co_await state->source.begin();
+				}
+				else {
+					co_await ++state->cursor;
+				}
+			}
+			catch (...)
+			{
+				state->fail(std::current_exception());
+			}
+			state->route();
+			if (state->completed) {
+				break;
+			}
+			keep = co_await state->park(std::move(keep));
+		}
 	}
 
-	template<typename T>
-	co_value_generator<T> never() {
-		for (;;) { 
-			co_await std::experimental::suspend_always{}; 
+	// stops waiting for a party that is destroyed
+	template<typename State>
+	struct group_by_canceler
+	{
+		std::shared_ptr<State> state;
+		std::shared_ptr<group_by_party> party;
+		~group_by_canceler() {
+			state->cancel(*party);
+		}
+	};
+
+	template<typename State>
+	co_value_generator<typename State::value_type> group_by_values(std::shared_ptr<State> state, std::shared_ptr<typename State::group> group) {
+		group_by_canceler<State> canceler{state, group};
+		for (;;) {
+			if (!group->queue.empty()) {
+				auto v = std::move(group->queue.front());
+				group->queue.pop_front();
+				co_yield v;
+			}
+			else if (group->expired || state->completed) {
+				break;
+			}
+			else {
+				co_await state->wait(*group);
+			}
+		}
+		if (state->error) {
+			std::rethrow_exception(state->error);
 		}
 	}
 
-	co_value_generator<int> ints(int first, int last) {
-		for (int cursor = first;; ++cursor) {
-			co_yield cursor;
-			if (cursor == last) break;
+	// a keyed substream produced by group_by. values() starts the substream
+	// and is called at most once.
+	template<typename State>
+	struct co_group
+	{
+		using key_type = typename State::key_type;
+		using value_type = typename State::value_type;
+
+		key_type const & key() const {
+			return group->key;
+		}
+
+		co_value_generator<value_type> values() const {
+			return group_by_values(state, group);
+		}
+
+		std::shared_ptr<State> state;
+		std::shared_ptr<typename State::group> group;
+	};
+
+	template<typename Source, typename KeySelector, typename State = group_by_state<std::decay_t<Source>, KeySelector>>
+	co_value_generator<co_group<State>> group_by(Source source, KeySelector select, std::chrono::steady_clock::duration idle) {
+		auto state = std::make_shared<State>(std::move(source), std::move(select), idle);
+		group_by_canceler<State> canceler{state, state->outer};
+		group_by_pump(state);
+		for (;;) {
+			if (!state->fresh.empty()) {
+				auto g = co_group<State>{state, std::move(state->fresh.front())};
+				state->fresh.pop_front();
+				g.group->emitted = true;
+				co_yield g;
+			}
+			else if (state->completed) {
+				break;
+			}
+			else {
+				co_await state->wait(*state->outer);
+			}
+		}
+		if (state->error) {
+			std::rethrow_exception(state->error);
 		}
 	}
 
-	auto merge() {
+	inline auto merge() {
 		return make_operator([=](auto&& source) {
 			return merge(std::forward<decltype(source)>(source));
 		});
 	}
 
-	auto concat() {
+	inline auto concat() {
 		return make_operator([=](auto&& source) {
 			return concat(std::forward<decltype(source)>(source));
 		});
 	}
 
+	inline auto concat(std::size_t prefetch, std::size_t buffer = 64) {
+		return make_operator([=](auto&& source) {
+			return concat(std::forward<decltype(source)>(source), prefetch, buffer);
+		});
+	}
+
+	template<typename Selector>
+	auto concat_map(Selector select) {
+		return make_operator([=](auto&& source) {
+			return concat(transform(std::forward<decltype(source)>(source), select));
+		});
+	}
+
+	template<typename Selector>
+	auto concat_map(Selector select, std::size_t prefetch, std::size_t buffer = 64) {
+		return make_operator([=](auto&& source) {
+			return concat(transform(std::forward<decltype(source)>(source), select), prefetch, buffer);
+		});
+	}
+
 	template<typename Selector>
 	auto transform(Selector select) {
 		return make_operator([=](auto&& source) {
@@ -697,18 +4186,18 @@ namespace co_alg {
 
 	template<typename Trigger>
 	auto take_until(Trigger trigger) {
-		return make_operator([=](auto&& source) {
-			return take_until(std::forward<decltype(source)>(source), trigger);
+		return make_operator([trigger = std::move(trigger)](auto&& source) mutable {
+			return take_until(std::forward<decltype(source)>(source), std::move(trigger));
 		});
 	}
 
-	auto take(ptrdiff_t count) {
+	inline auto take(std::ptrdiff_t count) {
 		return make_operator([=](auto&& source) {
 			return take(std::forward<decltype(source)>(source), count);
 		});
 	}
 
-	auto skip(ptrdiff_t count) {
+	inline auto skip(std::ptrdiff_t count) {
 		return make_operator([=](auto&& source) {
 			return skip(std::forward<decltype(source)>(source), count);
 		});
@@ -721,6 +4210,198 @@ namespace co_alg {
 		});
 	}
 
+	template<typename Seed, typename Accumulate>
+	auto scan(Seed seed, Accumulate accumulate) {
+		return make_operator([=](auto&& source) {
+			return scan(std::forward<decltype(source)>(source), seed, accumulate);
+		});
+	}
+
+	template<typename Seed, typename Accumulate>
+	auto reduce(Seed seed, Accumulate accumulate) {
+		return make_operator([=](auto&& source) {
+			return reduce(std::forward<decltype(source)>(source), seed, accumulate);
+		});
+	}
+
+	inline auto count() {
+		return make_operator([=](auto&& source) {
+			return count(std::forward<decltype(source)>(source));
+		});
+	}
+
+	inline auto sum() {
+		return make_operator([=](auto&& source) {
+			return sum(std::forward<decltype(source)>(source));
+		});
+	}
+
+	template<typename Compare>
+	auto min(Compare compare) {
+		return make_operator([=](auto&& source) {
+			return min(std::forward<decltype(source)>(source), compare);
+		});
+	}
+
+	inline auto min() {
+		return min(std::less<>());
+	}
+
+	template<typename Compare>
+	auto max(Compare compare) {
+		return make_operator([=](auto&& source) {
+			return max(std::forward<decltype(source)>(source), compare);
+		});
+	}
+
+	inline auto max() {
+		return max(std::less<>());
+	}
+
+	inline auto average() {
+		return make_operator([=](auto&& source) {
+			return average(std::forward<decltype(source)>(source));
+		});
+	}
+
+	template<typename Clock = co_tsc_clock>
+	auto timestamp() {
+		return make_operator([=](auto&& source) {
+			return timestamp<Clock>(std::forward<decltype(source)>(source));
+		});
+	}
+
+	template<typename Clock = co_tsc_clock>
+	auto time_interval() {
+		return make_operator([=](auto&& source) {
+			return time_interval<Clock>(std::forward<decltype(source)>(source));
+		});
+	}
+
+#if defined(CO_ALG_TRACE)
+
+	inline auto trace_source(std::shared_ptr<co_trace> trace) {
+		return make_operator([=](auto&& source) {
+			return trace_source(std::forward<decltype(source)>(source), trace);
+		});
+	}
+
+	inline auto trace_sink(std::shared_ptr<co_trace> trace) {
+		return make_operator([=](auto&& source) {
+			return trace_sink(std::forward<decltype(source)>(source), trace);
+		});
+	}
+
+#endif
+
+	inline auto on_backpressure(backpressure action, std::size_t capacity, std::shared_ptr<backpressure_stats> stats = nullptr) {
+		return make_operator([=](auto&& source) {
+			return on_backpressure(std::forward<decltype(source)>(source), action, capacity, stats);
+		});
+	}
+
+	template<typename Key>
+	auto distinct_until_changed(Key key) {
+		return make_operator([=](auto&& source) {
+			return distinct_until_changed(std::forward<decltype(source)>(source), key);
+		});
+	}
+
+	inline auto distinct_until_changed() {
+		return distinct_until_changed([](auto const & v) { return v; });
+	}
+
+	template<typename Key>
+	auto distinct(Key key) {
+		return make_operator([=](auto&& source) {
+			return distinct(std::forward<decltype(source)>(source), key);
+		});
+	}
+
+	inline auto distinct() {
+		return distinct([](auto const & v) { return v; });
+	}
+
+	template<typename Key>
+	auto distinct(Key key, distinct_filter filter) {
+		return make_operator([=](auto&& source) {
+			return distinct(std::forward<decltype(source)>(source), key, filter);
+		});
+	}
+
+	inline auto to_vector(std::size_t reserve_hint = 0) {
+		return make_operator([=](auto&& source) {
+			return to_vector(std::forward<decltype(source)>(source), reserve_hint);
+		});
+	}
+
+	template<typename F>
+	auto for_each(F f) {
+		return make_operator([=](auto&& source) {
+			return for_each(std::forward<decltype(source)>(source), f);
+		});
+	}
+
+	inline auto first() {
+		return make_operator([=](auto&& source) {
+			return first(std::forward<decltype(source)>(source));
+		});
+	}
+
+	inline auto last() {
+		return make_operator([=](auto&& source) {
+			return last(std::forward<decltype(source)>(source));
+		});
+	}
+
+	inline auto to_any() {
+		return make_operator([=](auto&& source) {
+			return to_any(std::forward<decltype(source)>(source));
+		});
+	}
+
+	inline auto replay(std::size_t count, std::size_t budget = SIZE_MAX) {
+		return make_operator([=](auto&& source) {
+			return replay(std::forward<decltype(source)>(source), replay_policy{count, std::chrono::steady_clock::duration::max(), budget});
+		});
+	}
+
+	inline auto replay(std::chrono::steady_clock::duration window, std::size_t budget = SIZE_MAX) {
+		return make_operator([=](auto&& source) {
+			return replay(std::forward<decltype(source)>(source), replay_policy{SIZE_MAX, window, budget});
+		});
+	}
+
+	template<typename Key, typename Compare>
+	auto merge_sorted(Key key, Compare compare) {
+		return make_operator([=](auto&& source) {
+			return merge_sorted(std::forward<decltype(source)>(source), key, compare);
+		});
+	}
+
+	template<typename Key>
+	auto merge_sorted(Key key) {
+		return merge_sorted(key, std::less<>());
+	}
+
+	inline auto merge_sorted() {
+		return merge_sorted([](auto const & v) { return v; });
+	}
+
+	template<typename Key, typename Compare>
+	auto merge_sorted(Key key, Compare compare, std::size_t batch) {
+		return make_operator([=](auto&& source) {
+			return merge_sorted(std::forward<decltype(source)>(source), key, compare, batch);
+		});
+	}
+
+	template<typename KeySelector>
+	auto group_by(KeySelector select, std::chrono::steady_clock::duration idle = std::chrono::steady_clock::duration::max()) {
+		return make_operator([=](auto&& source) {
+			return group_by(std::forward<decltype(source)>(source), select, idle);
+		});
+	}
+
 	template<typename Source, typename Bind>
 	auto operator|(Source&& source, co_operator<Bind> op)  -> decltype(op.bind(std::forward<Source>(source))) {
 		return op.bind(std::forward<Source>(source));
@@ -0,0 +1,1537 @@
+#pragma once
+
+// linux sources and sinks for co_alg. an epoll reactor thread resumes the
+// coroutines that wait on file descriptors, receive buffers come from a
+// recycled slab pool, files are read through io_uring or mapped,
+// streams can be recorded to a mapped log and replayed from it, and a
+// stream can be sharded over pinned worker threads.
+
+#include "co_algorithm.h"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace co_alg {
+
+	inline std::system_error co_errno_error(const char* what) {
+		return std::system_error(errno, std::generic_category(), what);
+	}
+
+	// a thread that waits on epoll and resumes the coroutines waiting for
+	// their file descriptors. a coroutine that waits on the reactor
+	// continues on the reactor thread.
+	class co_reactor
+	{
+	public:
+		// one file descriptor watched by the reactor. the descriptor is added
+		// to epoll by the first wait and removed when the registration is
+		// destroyed, which must be on the reactor thread or while nothing is
+		// waiting.
+		class registration
+		{
+		public:
+			struct awaiter
+			{
+				registration* that;
+				std::uint32_t events;
+
+				bool await_ready() noexcept {
+					return false;
+				}
+				void await_suspend(coroutine_handle<> handle) {
+					that->waiter = handle;
+					// the reactor may resume the handle before this returns
+					that->arm(events);
+				}
+				void await_resume() noexcept {
+				}
+			};
+
+			registration(co_reactor& r, int fd) : reactor(std::addressof(r)), fd(fd) {}
+			registration(const registration&) = delete;
+			registration& operator=(const registration&) = delete;
+
+			~registration() {
+				if (added) {
+					::epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, nullptr);
+					if (reactor->on_reactor_thread()) {
+						reactor->forget(this);
+					}
+				}
+			}
+
+			awaiter readable() {
+				return awaiter{this, EPOLLIN | EPOLLRDHUP};
+			}
+			awaiter writable() {
+				return awaiter{this, EPOLLOUT};
+			}
+
+		private:
+			friend class co_reactor;
+
+			void arm(std::uint32_t events) {
+				epoll_event ev{};
+				ev.events = events | EPOLLONESHOT;
+				ev.data.ptr = this;
+				auto op = added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+				added = true;
+				if (::epoll_ctl(reactor->epfd, op, fd, &ev) != 0) {
+					added = op == EPOLL_CTL_MOD;
+					waiter = nullptr;
+					throw co_errno_error("epoll_ctl");
+				}
+			}
+
+			co_reactor* reactor;
+			int fd;
+			bool added = false;
+			coroutine_handle<> waiter;
+		};
+
+		co_reactor() {
+			epfd = ::epoll_create1(EPOLL_CLOEXEC);
+			if (epfd < 0) {
+				throw co_errno_error("epoll_create1");
+			}
+			wakefd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			epoll_event ev{};
+			ev.events = EPOLLIN;
+			ev.data.ptr = nullptr;
+			if (wakefd < 0 || ::epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) != 0) {
+				auto e = co_errno_error("eventfd");
+				close();
+				throw e;
+			}
+			thread = std::thread([this] {
+				run();
+			});
+		}
+
+		co_reactor(const co_reactor&) = delete;
+		co_reactor& operator=(const co_reactor&) = delete;
+
+		~co_reactor() {
+			stopping.store(true);
+			std::uint64_t one = 1;
+			while (::write(wakefd, &one, sizeof(one)) < 0 && errno == EINTR) {
+			}
+			thread.join();
+			close();
+		}
+
+		bool on_reactor_thread() const {
+			return std::this_thread::get_id() == thread.get_id();
+		}
+
+	private:
+		void run() {
+			while (!stopping.load()) {
+				ready_count = ::epoll_wait(epfd, ready.data(), static_cast<int>(ready.size()), -1);
+				if (ready_count < 0) {
+					ready_count = 0;
+					if (errno == EINTR) {
+						continue;
+					}
+					return;
+				}
+				for (ready_index = 0; ready_index < ready_count; ++ready_index) {
+					// null for the wake descriptor and for registrations destroyed by an earlier event
+					auto r = static_cast<registration*>(ready[ready_index].data.ptr);
+					if (!r) {
+						continue;
+					}
+					auto w = r->waiter;
+					r->waiter = nullptr;
+					if (!!w) {
+						w.resume();
+					}
+				}
+				ready_count = 0;
+			}
+		}
+
+		void forget(registration* r) {
+			for (int i = ready_index + 1; i < ready_count; ++i) {
+				if (ready[i].data.ptr == r) {
+					ready[i].data.ptr = nullptr;
+				}
+			}
+		}
+
+		void close() {
+			if (wakefd >= 0) {
+				::close(wakefd);
+			}
+			if (epfd >= 0) {
+				::close(epfd);
+			}
+		}
+
+		int epfd = -1;
+		int wakefd = -1;
+		std::atomic<bool> stopping{false};
+		std::array<epoll_event, 64> ready;
+		int ready_count = 0;
+		int ready_index = 0;
+		std::thread thread;
+	};
+
+	// fixed size buffers carved out of larger slabs. released buffers go on
+	// a free list, so a steady stream of reads does not allocate.
+	class co_buffer_pool
+	{
+	public:
+		explicit co_buffer_pool(std::size_t buffer_size = 64 * 1024, std::size_t buffers_per_slab = 16) :
+			size(buffer_size),
+			per_slab(buffers_per_slab == 0 ? 1 : buffers_per_slab)
+		{}
+
+		co_buffer_pool(const co_buffer_pool&) = delete;
+		co_buffer_pool& operator=(const co_buffer_pool&) = delete;
+
+		std::size_t buffer_size() const {
+			return size;
+		}
+
+		std::byte* acquire() {
+			std::lock_guard<std::mutex> guard(lock);
+			if (free.empty()) {
+				grow();
+			}
+			auto b = free.back();
+			free.pop_back();
+			return b;
+		}
+
+		void release(std::byte* b) {
+			std::lock_guard<std::mutex> guard(lock);
+			free.push_back(b);
+		}
+
+	private:
+		void grow() {
+			slabs.emplace_back(new std::byte[size * per_slab]);
+			free.reserve(slabs.size() * per_slab);
+			for (std::size_t i = 0; i < per_slab; ++i) {
+				free.push_back(slabs.back().get() + i * size);
+			}
+		}
+
+		std::size_t size;
+		std::size_t per_slab;
+		std::mutex lock;
+		std::vector<std::unique_ptr<std::byte[]>> slabs;
+		std::vector<std::byte*> free;
+	};
+
+	// a buffer borrowed from a pool until this is destroyed
+	class co_pooled_buffer
+	{
+	public:
+		explicit co_pooled_buffer(co_buffer_pool& p) : pool(std::addressof(p)), b(p.acquire()) {}
+
+		co_pooled_buffer(const co_pooled_buffer&) = delete;
+		co_pooled_buffer& operator=(const co_pooled_buffer&) = delete;
+
+		~co_pooled_buffer() {
+			pool->release(b);
+		}
+
+		std::byte* data() const {
+			return b;
+		}
+		std::size_t size() const {
+			return pool->buffer_size();
+		}
+
+	private:
+		co_buffer_pool* pool;
+		std::byte* b;
+	};
+
+	// yields the bytes received on a nonblocking socket as they arrive. each
+	// span points into a pooled buffer that goes back to the pool when the
+	// consumer advances, nothing is copied. completes when the peer shuts
+	// down its side. fd is not closed.
+	inline co_value_generator<std::span<const std::byte>> read_socket(int fd, co_reactor& reactor, std::shared_ptr<co_buffer_pool> pool = std::make_shared<co_buffer_pool>()) {
+		co_reactor::registration reg(reactor, fd);
+		bool wait = false;
+		for (;;) {
+			if (wait) {
+				wait = false;
+				co_await reg.readable();
+			}
+			// the buffer is only held while it has bytes in it
+			co_pooled_buffer buffer(*pool);
+			auto n = ::recv(fd, buffer.data(), buffer.size(), 0);
+			if (n > 0) {
+				co_yield std::span<const std::byte>(buffer.data(), static_cast<std::size_t>(n));
+			}
+			else if (n == 0) {
+				break;
+			}
+			else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				wait = true;
+			}
+			else if (errno != EINTR) {
+				throw co_errno_error("recv");
+			}
+		}
+	}
+
+	// a value is a buffer when it has contiguous data() and size()
+	template<typename T, typename = void>
+	struct co_is_buffer : std::false_type {};
+
+	template<typename T>
+	struct co_is_buffer<T, decltype(void(std::declval<T const &>().data()), void(std::declval<T const &>().size()))> : std::true_type {};
+
+	// appends the iovecs for a buffer or for a range of buffers
+	template<typename T>
+	void co_gather(std::vector<iovec>& iov, T const & v) {
+		if constexpr (requires { typename T::value_type; requires co_is_buffer<typename T::value_type>::value; }) {
+			for (auto& b : v) {
+				co_gather(iov, b);
+			}
+		}
+		else {
+			static_assert(co_is_buffer<T>::value, "write_socket requires buffers or ranges of buffers");
+			auto bytes = std::as_bytes(std::span(v.data(), v.size()));
+			iov.push_back(iovec{const_cast<std::byte*>(bytes.data()), bytes.size()});
+		}
+	}
+
+	// writes the buffers from source to a nonblocking socket and yields the
+	// number of bytes written when the source completes. a value is a buffer
+	// or a range of buffers, the buffers of one value go out in a single
+	// gathering sendmsg (writev when fd is not a socket). fd is not closed.
+	template<typename Source>
+	co_value_generator<std::size_t> write_socket(Source source, int fd, co_reactor& reactor) {
+		co_reactor::registration reg(reactor, fd);
+		std::vector<iovec> iov;
+		std::size_t total = 0;
+		bool socket = true;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			iov.clear();
+			co_gather(iov, *it);
+			std::size_t first = 0;
+			while (first < iov.size()) {
+				auto count = std::min<std::size_t>(iov.size() - first, IOV_MAX);
+				ssize_t n;
+				if (socket) {
+					msghdr msg{};
+					msg.msg_iov = iov.data() + first;
+					msg.msg_iovlen = count;
+					n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+				}
+				else {
+					n = ::writev(fd, iov.data() + first, static_cast<int>(count));
+				}
+				if (n >= 0) {
+					total += static_cast<std::size_t>(n);
+					// step over what was written, the rest is sent by the next call
+					auto left = static_cast<std::size_t>(n);
+					while (first < iov.size() && left >= iov[first].iov_len) {
+						left -= iov[first].iov_len;
+						++first;
+					}
+					if (left != 0) {
+						iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+						iov[first].iov_len -= left;
+					}
+				}
+				else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					co_await reg.writable();
+				}
+				else if (errno == ENOTSOCK && socket) {
+					socket = false;
+				}
+				else if (errno != EINTR) {
+					throw co_errno_error(socket ? "sendmsg" : "writev");
+				}
+			}
+			co_await ++it;
+		}
+		co_yield total;
+	}
+
+	inline auto write_socket(int fd, co_reactor& reactor) {
+		return make_operator([fd, r = std::addressof(reactor)](auto&& source) {
+			return write_socket(std::forward<decltype(source)>(source), fd, *r);
+		});
+	}
+
+	// closes a file descriptor
+	struct co_file_descriptor
+	{
+		explicit co_file_descriptor(int f) : fd(f) {}
+		co_file_descriptor(const co_file_descriptor&) = delete;
+		co_file_descriptor& operator=(const co_file_descriptor&) = delete;
+		~co_file_descriptor() {
+			if (fd >= 0) {
+				::close(fd);
+			}
+		}
+
+		int fd;
+	};
+
+	// a minimal io_uring. the owner submits and reaps from a single thread.
+	// destroying the ring waits for the requests still in flight, so the
+	// buffers they target must outlive it.
+	class co_uring
+	{
+	public:
+		explicit co_uring(unsigned entries) {
+			io_uring_params params{};
+			fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+			if (fd < 0) {
+				throw co_errno_error("io_uring_setup");
+			}
+			sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP) {
+				sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+			}
+			sq_ring = ::mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring :
+				::mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+			sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+			if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+				auto e = co_errno_error("mmap");
+				unmap();
+				::close(fd);
+				throw e;
+			}
+			auto sq = static_cast<char*>(sq_ring);
+			sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+			sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			sq_entries = params.sq_entries;
+			sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			auto cq = static_cast<char*>(cq_ring);
+			cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		}
+
+		co_uring(const co_uring&) = delete;
+		co_uring& operator=(const co_uring&) = delete;
+
+		~co_uring() {
+			while (inflight != 0) {
+				if (!reap([](io_uring_cqe const &) {})) {
+					::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				}
+			}
+			unmap();
+			::close(fd);
+		}
+
+		int descriptor() const {
+			return fd;
+		}
+
+		// pins the buffers for IORING_OP_READ_FIXED, false when the kernel refuses
+		bool register_buffers(iovec const * iov, unsigned count) {
+			return ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+		}
+
+		// queues and submits one request, the sqe is filled in by prepare
+		template<typename Prepare>
+		void submit(Prepare prepare) {
+			auto tail = *sq_tail;
+			if (tail - std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire) == sq_entries) {
+				throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "io_uring submission queue full");
+			}
+			auto index = tail & sq_mask;
+			auto& sqe = sqes[index];
+			sqe = io_uring_sqe{};
+			prepare(sqe);
+			sq_array[index] = index;
+			std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+			for (;;) {
+				auto r = ::syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+				if (r >= 0) {
+					break;
+				}
+				if (errno != EINTR && errno != EAGAIN) {
+					throw co_errno_error("io_uring_enter");
+				}
+			}
+			++inflight;
+		}
+
+		// hands every available completion to f, false when there were none
+		template<typename F>
+		bool reap(F&& f) {
+			auto head = *cq_head;
+			auto tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+			if (head == tail) {
+				return false;
+			}
+			for (; head != tail; ++head) {
+				--inflight;
+				f(cqes[head & cq_mask]);
+			}
+			std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		void unmap() {
+			if (sqes != MAP_FAILED && sqes != nullptr) {
+				::munmap(sqes, sqe_bytes);
+			}
+			if (cq_ring != MAP_FAILED && cq_ring != nullptr && cq_ring != sq_ring) {
+				::munmap(cq_ring, cq_bytes);
+			}
+			if (sq_ring != MAP_FAILED && sq_ring != nullptr) {
+				::munmap(sq_ring, sq_bytes);
+			}
+		}
+
+		int fd = -1;
+		std::size_t inflight = 0;
+		void* sq_ring = nullptr;
+		void* cq_ring = nullptr;
+		io_uring_sqe* sqes = nullptr;
+		std::size_t sq_bytes = 0;
+		std::size_t cq_bytes = 0;
+		std::size_t sqe_bytes = 0;
+		unsigned* sq_head = nullptr;
+		unsigned* sq_tail = nullptr;
+		unsigned* sq_array = nullptr;
+		unsigned sq_mask = 0;
+		unsigned sq_entries = 0;
+		unsigned* cq_head = nullptr;
+		unsigned* cq_tail = nullptr;
+		unsigned cq_mask = 0;
+		io_uring_cqe* cqes = nullptr;
+	};
+
+	inline int co_open_read(std::string const & path) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			throw co_errno_error("open");
+		}
+		return fd;
+	}
+
+	// keeps queue_depth chunk reads in flight. each chunk lives in its own
+	// registered buffer, which is read into again once the consumer
+	// advances past it. the reactor resumes the reader when the completion
+	// queue has entries. the size is not taken from fstat, the file ends
+	// at the first read that returns no bytes, so a file that grows or
+	// reports no size (procfs) is read to its end. only for regular files,
+	// the reads are at offsets.
+	inline co_value_generator<std::span<const std::byte>> read_file_uring(std::string path, std::unique_ptr<co_uring> ring, co_reactor& reactor, std::size_t chunk_size, unsigned queue_depth) {
+		co_file_descriptor file(co_open_read(path));
+		// the first chunk that found the end of the file
+		auto end = std::numeric_limits<std::size_t>::max();
+
+		struct slot
+		{
+			std::size_t filled = 0;
+			bool ready = false;
+		};
+		std::vector<slot> slots(queue_depth);
+		// declared before the ring, so the ring drains before the buffers go away
+		std::unique_ptr<std::byte[]> storage(new std::byte[chunk_size * queue_depth]);
+		auto owned = std::move(ring);
+		co_reactor::registration completions(reactor, owned->descriptor());
+
+		std::vector<iovec> iov(queue_depth);
+		for (unsigned i = 0; i < queue_depth; ++i) {
+			iov[i] = iovec{storage.get() + i * chunk_size, chunk_size};
+		}
+		auto fixed = owned->register_buffers(iov.data(), queue_depth);
+
+		auto read = [&](std::size_t k) {
+			auto s = static_cast<unsigned>(k % queue_depth);
+			auto done = slots[s].filled;
+			owned->submit([&](io_uring_sqe& sqe) {
+				sqe.opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+				sqe.fd = file.fd;
+				sqe.addr = reinterpret_cast<std::uint64_t>(storage.get() + s * chunk_size + done);
+				sqe.len = static_cast<std::uint32_t>(chunk_size - done);
+				sqe.off = k * chunk_size + done;
+				sqe.buf_index = static_cast<std::uint16_t>(s);
+				sqe.user_data = k;
+			});
+		};
+
+		for (std::size_t k = 0; k < queue_depth; ++k) {
+			read(k);
+		}
+		std::exception_ptr error;
+		for (std::size_t k = 0;; ++k) {
+			auto& current = slots[k % queue_depth];
+			while (!current.ready && !error) {
+				auto reaped = owned->reap([&](io_uring_cqe const & cqe) {
+					auto c = static_cast<std::size_t>(cqe.user_data);
+					auto& s = slots[c % queue_depth];
+					if (cqe.res < 0) {
+						error = std::make_exception_ptr(std::system_error(-cqe.res, std::generic_category(), "read"));
+					}
+					else if (cqe.res == 0) {
+						s.ready = true;
+						end = std::min(end, c);
+					}
+					else {
+						s.filled += static_cast<std::size_t>(cqe.res);
+						if (s.filled < chunk_size) {
+							// a short read, ask for the rest
+							read(c);
+						}
+						else {
+							s.ready = true;
+						}
+					}
+				});
+				if (!reaped) {
+					co_await completions.readable();
+				}
+			}
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			if (current.filled == 0) {
+				break;
+			}
+			auto last = current.filled < chunk_size;
+			co_yield std::span<const std::byte>(storage.get() + (k % queue_depth) * chunk_size, current.filled);
+			if (last) {
+				break;
+			}
+			// the consumer is done with the chunk, its buffer takes the next read
+			current = slot{};
+			if (k + queue_depth < end) {
+				read(k + queue_depth);
+			}
+		}
+	}
+
+	// pread into one buffer. the kernel is asked to read ahead the next
+	// queue_depth chunks while the consumer works on the current one. a
+	// pipe, FIFO or device has no offsets and is read with read().
+	inline co_value_generator<std::span<const std::byte>> read_file_pread(std::string path, std::size_t chunk_size, unsigned queue_depth) {
+		co_file_descriptor file(co_open_read(path));
+		struct stat st{};
+		if (::fstat(file.fd, &st) != 0) {
+			throw co_errno_error("fstat");
+		}
+		auto stream = !S_ISREG(st.st_mode);
+		if (!stream) {
+			::posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+		std::unique_ptr<std::byte[]> buffer(new std::byte[chunk_size]);
+		off_t offset = 0;
+		for (;;) {
+			ssize_t n;
+			if (stream) {
+				n = ::read(file.fd, buffer.get(), chunk_size);
+			}
+			else {
+				::posix_fadvise(file.fd, offset + static_cast<off_t>(chunk_size), static_cast<off_t>(chunk_size * queue_depth), POSIX_FADV_WILLNEED);
+				n = ::pread(file.fd, buffer.get(), chunk_size, offset);
+			}
+			if (n > 0) {
+				offset += n;
+				co_yield std::span<const std::byte>(buffer.get(), static_cast<std::size_t>(n));
+			}
+			else if (n == 0) {
+				break;
+			}
+			else if (errno != EINTR) {
+				throw co_errno_error(stream ? "read" : "pread");
+			}
+		}
+	}
+
+	// yields the contents of a file in chunks of chunk_size bytes, up to
+	// the first read that returns no bytes. a chunk is valid until the
+	// consumer advances. a regular file is read with io_uring with
+	// queue_depth reads in flight, or pread with kernel read ahead when
+	// io_uring is not available. anything else, a pipe, FIFO or device,
+	// is read in order with read(), reads at offsets would reorder it.
+	inline co_value_generator<std::span<const std::byte>> read_file(std::string path, co_reactor& reactor, std::size_t chunk_size = 256 * 1024, unsigned queue_depth = 4) {
+		if (chunk_size == 0) {
+			chunk_size = 1;
+		}
+		if (queue_depth == 0) {
+			queue_depth = 1;
+		}
+		// a path that cannot be stat'ed fails when the reader opens it
+		struct stat st{};
+		if (::stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode)) {
+			return read_file_pread(std::move(path), chunk_size, queue_depth);
+		}
+		std::unique_ptr<co_uring> ring;
+		try
+		{
+			ring = std::make_unique<co_uring>(queue_depth);
+		}
+		catch (std::system_error const &)
+		{
+		}
+		if (!ring) {
+			return read_file_pread(std::move(path), chunk_size, queue_depth);
+		}
+		return read_file_uring(std::move(path), std::move(ring), reactor, chunk_size, queue_depth);
+	}
+
+	// a read only mapping of a whole file, advised for sequential access
+	class co_mapped_file
+	{
+	public:
+		explicit co_mapped_file(std::string const & path) {
+			co_file_descriptor file(co_open_read(path));
+			struct stat st{};
+			if (::fstat(file.fd, &st) != 0) {
+				throw co_errno_error("fstat");
+			}
+			length = static_cast<std::size_t>(st.st_size);
+			if (length != 0) {
+				auto p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file.fd, 0);
+				if (p == MAP_FAILED) {
+					throw co_errno_error("mmap");
+				}
+				::madvise(p, length, MADV_SEQUENTIAL);
+				bytes = static_cast<const char*>(p);
+			}
+		}
+
+		co_mapped_file(const co_mapped_file&) = delete;
+		co_mapped_file& operator=(const co_mapped_file&) = delete;
+
+		~co_mapped_file() {
+			if (bytes) {
+				::munmap(const_cast<char*>(bytes), length);
+			}
+		}
+
+		const char* data() const {
+			return bytes;
+		}
+		std::size_t size() const {
+			return length;
+		}
+
+	private:
+		const char* bytes = nullptr;
+		std::size_t length = 0;
+	};
+
+	// finds each occurrence of a byte in order. with sse2 a block of 64 bytes
+	// is compared at once into a bit mask, so a short record costs a few
+	// instructions instead of a call to memchr.
+	class co_byte_scanner
+	{
+	public:
+		co_byte_scanner(const char* first, const char* last, char c) : block(first), last(last), c(c) {}
+
+		// the next occurrence, last when there are no more
+		const char* next() {
+			while (mask == 0) {
+				if (block == last) {
+					return last;
+				}
+				load();
+			}
+			auto i = std::countr_zero(mask);
+			mask &= mask - 1;
+			return base + i;
+		}
+
+	private:
+		void load() {
+			base = block;
+			auto n = static_cast<std::size_t>(last - block);
+			if (n >= 64) {
+#if defined(__SSE2__)
+				auto needle = _mm_set1_epi8(c);
+				auto at = [&](int i) {
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 16));
+					return static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)))) << (i * 16);
+				};
+				mask = at(0) | at(1) | at(2) | at(3);
+#else
+				for (std::size_t i = 0; i < 64; ++i) {
+					mask |= static_cast<std::uint64_t>(block[i] == c) << i;
+				}
+#endif
+				block += 64;
+			}
+			else {
+				for (std::size_t i = 0; i < n; ++i) {
+					mask |= static_cast<std::uint64_t>(block[i] == c) << i;
+				}
+				block = last;
+			}
+		}
+
+		const char* block;
+		const char* base = nullptr;
+		const char* last;
+		std::uint64_t mask = 0;
+		char c;
+	};
+
+	// how the records of a file are framed
+	struct record_format
+	{
+		enum class framing { delimiter, length_prefix };
+
+		// records end with the delimiter, the last one may omit it
+		static record_format delimited(char delimiter = '\n') {
+			return record_format{framing::delimiter, delimiter};
+		}
+		// each record follows its length as a 32 bit little endian integer
+		static record_format length_prefixed() {
+			return record_format{framing::length_prefix, 0};
+		}
+
+		framing kind;
+		char delimiter;
+	};
+
+	// yields the records in [first, last) of a mapped file. the views point
+	// into the mapping and stay valid while the generator is alive.
+	inline co_value_generator<std::string_view> mapped_records(std::shared_ptr<co_mapped_file> file, std::size_t first, std::size_t last, record_format format) {
+		auto base = file->data();
+		if (format.kind == record_format::framing::delimiter) {
+			co_byte_scanner scan(base + first, base + last, format.delimiter);
+			auto begin = base + first;
+			for (;;) {
+				auto end = scan.next();
+				if (end == base + last) {
+					if (begin != end) {
+						co_yield std::string_view(begin, static_cast<std::size_t>(end - begin));
+					}
+					break;
+				}
+				co_yield std::string_view(begin, static_cast<std::size_t>(end - begin));
+				begin = end + 1;
+			}
+		}
+		else {
+			auto at = first;
+			while (at != last) {
+				if (last - at < 4) {
+					throw std::runtime_error("mmap_records: truncated length prefix");
+				}
+				std::uint32_t length;
+				std::memcpy(&length, base + at, 4);
+				if constexpr (std::endian::native == std::endian::big) {
+					length = __builtin_bswap32(length);
+				}
+				at += 4;
+				if (last - at < length) {
+					throw std::runtime_error("mmap_records: truncated record");
+				}
+				co_yield std::string_view(base + at, length);
+				at += length;
+			}
+		}
+	}
+
+	// yields the records of a file as views straight into a mapping of it,
+	// nothing is copied. throws when the file cannot be mapped.
+	inline co_value_generator<std::string_view> mmap_records(std::string const & path, record_format format = record_format::delimited()) {
+		auto file = std::make_shared<co_mapped_file>(path);
+		auto size = file->size();
+		return mapped_records(std::move(file), 0, size, format);
+	}
+
+	// splits a delimited file into up to count ranges that start at record
+	// boundaries and share one mapping. each generator is independent, so
+	// the ranges can be consumed on separate threads and their results
+	// combined. a length prefixed file has no boundaries to split at and is
+	// returned as one range.
+	inline std::vector<co_value_generator<std::string_view>> mmap_record_ranges(std::string const & path, std::size_t count, record_format format = record_format::delimited()) {
+		auto file = std::make_shared<co_mapped_file>(path);
+		auto size = file->size();
+		if (format.kind != record_format::framing::delimiter || count == 0) {
+			count = 1;
+		}
+		std::vector<std::size_t> bounds{0};
+		for (std::size_t i = 1; i < count; ++i) {
+			auto target = std::max(size / count * i, bounds.back());
+			if (target == 0) {
+				bounds.push_back(0);
+				continue;
+			}
+			// the range starts after the delimiter that ends the record holding target - 1
+			auto from = file->data() + target - 1;
+			auto d = static_cast<const char*>(std::memchr(from, format.delimiter, size - (target - 1)));
+			bounds.push_back(d ? static_cast<std::size_t>(d - file->data()) + 1 : size);
+		}
+		bounds.push_back(size);
+		std::vector<co_value_generator<std::string_view>> ranges;
+		for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+			ranges.push_back(mapped_records(file, bounds[i], bounds[i + 1], format));
+		}
+		return ranges;
+	}
+
+	// the ranges of mmap_record_ranges as a source of generators, for the
+	// operators that combine them. merge interleaves the ranges on the
+	// thread that drives it, a range that a pipeline hands to another
+	// thread keeps its mapping alive there.
+	//   mmap_records(path, 4) | merge() | count()
+	inline auto mmap_records(std::string const & path, std::size_t parts, record_format format = record_format::delimited()) {
+		return from_range(mmap_record_ranges(path, parts, format));
+	}
+
+	// a timerfd on the reactor, waits for points on the steady clock
+	class co_timer
+	{
+	public:
+		struct awaiter
+		{
+			co_timer* that;
+			co_reactor::registration::awaiter wait;
+
+			bool await_ready() noexcept {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				wait.await_suspend(handle);
+			}
+			void await_resume() {
+				std::uint64_t expirations;
+				while (::read(that->file.fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {
+				}
+			}
+		};
+
+		explicit co_timer(co_reactor& reactor) :
+			file(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+			reg(reactor, file.fd)
+		{
+			if (file.fd < 0) {
+				throw co_errno_error("timerfd_create");
+			}
+		}
+
+		// steady_clock is CLOCK_MONOTONIC
+		awaiter at(std::chrono::steady_clock::time_point when) {
+			// a zero value would disarm the timer
+			auto ns = std::max<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count(), 1);
+			itimerspec spec{};
+			spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+			spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+			if (::timerfd_settime(file.fd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+				throw co_errno_error("timerfd_settime");
+			}
+			return awaiter{this, reg.readable()};
+		}
+
+	private:
+		co_file_descriptor file;
+		co_reactor::registration reg;
+	};
+
+	// extension point for the record log. specialize it for types that are
+	// not trivially copyable.
+	template<typename T>
+	struct co_serializer
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "specialize co_serializer for types that are not trivially copyable");
+
+		std::size_t size(T const &) const {
+			return sizeof(T);
+		}
+		void write(T const & v, std::byte* out) const {
+			std::memcpy(out, std::addressof(v), sizeof(T));
+		}
+		T read(std::span<const std::byte> in) const {
+			std::array<std::byte, sizeof(T)> raw;
+			std::memcpy(raw.data(), in.data(), sizeof(T));
+			return std::bit_cast<T>(raw);
+		}
+	};
+
+	// the record log is a series of segment files, path.000000, path.000001
+	// and so on. a segment starts with co_log_magic and holds records of a
+	// co_log_entry followed by the payload, padded to 8 bytes. a zero stamp
+	// ends the segment.
+	constexpr char co_log_magic[8] = {'c', 'o', '_', 'l', 'o', 'g', '1', '\n'};
+
+	struct co_log_entry
+	{
+		// steady clock nanoseconds when the value was recorded, never 0
+		std::uint64_t stamp;
+		std::uint32_t size;
+		std::uint32_t reserved;
+	};
+
+	inline std::string co_log_segment(std::string const & path, std::size_t index) {
+		auto n = std::to_string(index);
+		return path + "." + std::string(n.size() < 6 ? 6 - n.size() : 0, '0') + n;
+	}
+
+	// appends records to mapped segments. a segment is grown to
+	// segment_bytes up front and truncated to what was used when it is
+	// closed. segments left by an earlier recording to the same path are
+	// removed.
+	class co_log_writer
+	{
+	public:
+		co_log_writer(std::string p, std::size_t segment) : path(std::move(p)), segment_bytes(segment) {
+			for (std::size_t i = 0; ::unlink(co_log_segment(path, i).c_str()) == 0; ++i) {
+			}
+		}
+
+		co_log_writer(const co_log_writer&) = delete;
+		co_log_writer& operator=(const co_log_writer&) = delete;
+
+		~co_log_writer() {
+			close();
+		}
+
+		template<typename Write>
+		void append(std::size_t size, Write write) {
+			auto need = sizeof(co_log_entry) + ((size + 7) & ~std::size_t(7));
+			if (!map || used + need > mapped) {
+				close();
+				open(need);
+			}
+			auto stamp = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+			co_log_entry entry{stamp == 0 ? 1 : stamp, static_cast<std::uint32_t>(size), 0};
+			write(map + used + sizeof(co_log_entry));
+			std::memcpy(map + used, &entry, sizeof(entry));
+			used += need;
+		}
+
+	private:
+		void open(std::size_t need) {
+			mapped = std::max(segment_bytes, sizeof(co_log_magic) + need + sizeof(co_log_entry));
+			fd = ::open(co_log_segment(path, index++).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0) {
+				throw co_errno_error("open");
+			}
+			if (::ftruncate(fd, static_cast<off_t>(mapped)) != 0) {
+				auto e = co_errno_error("ftruncate");
+				::close(fd);
+				throw e;
+			}
+			auto p = ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED) {
+				auto e = co_errno_error("mmap");
+				::close(fd);
+				throw e;
+			}
+			map = static_cast<std::byte*>(p);
+			std::memcpy(map, co_log_magic, sizeof(co_log_magic));
+			used = sizeof(co_log_magic);
+		}
+
+		void close() {
+			if (!map) {
+				return;
+			}
+			::munmap(map, mapped);
+			map = nullptr;
+			// keep a zeroed entry as the end marker
+			::ftruncate(fd, static_cast<off_t>(std::min(used + sizeof(co_log_entry), mapped)));
+			::close(fd);
+		}
+
+		std::string path;
+		std::size_t segment_bytes;
+		std::size_t index = 0;
+		int fd = -1;
+		std::byte* map = nullptr;
+		std::size_t mapped = 0;
+		std::size_t used = 0;
+	};
+
+	// passes every value through after appending it to the record log at path
+	template<typename Source, typename SourceValue = typename std::decay_t<Source>::value_type>
+	co_value_generator<SourceValue> record(Source source, std::string path, std::size_t segment_bytes) {
+		co_log_writer log(std::move(path), segment_bytes);
+		co_serializer<SourceValue> serializer;
+		auto it = co_await source.begin();
+		while (it != source.end()) {
+			auto& v = *it;
+			log.append(serializer.size(v), [&](std::byte* out) {
+				serializer.write(v, out);
+			});
+			co_yield v;
+			co_await ++it;
+		}
+	}
+
+	inline auto record(std::string path, std::size_t segment_bytes = 64 * 1024 * 1024) {
+		return make_operator([=](auto&& source) {
+			return record(std::forward<decltype(source)>(source), path, segment_bytes);
+		});
+	}
+
+	// plays back a log written by record. with a reactor the values keep the
+	// spacing they were recorded with, divided by speed. without one, or
+	// when speed is not positive, they come as fast as they can be read.
+	template<typename T>
+	co_value_generator<T> replay_log(std::string path, co_reactor* reactor, double speed) {
+		std::unique_ptr<co_timer> timer;
+		if (reactor && speed > 0) {
+			timer = std::make_unique<co_timer>(*reactor);
+		}
+		co_serializer<T> serializer;
+		std::uint64_t first = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t index = 0;; ++index) {
+			auto name = co_log_segment(path, index);
+			if (::access(name.c_str(), F_OK) != 0) {
+				break;
+			}
+			co_mapped_file segment(name);
+			auto at = segment.data();
+			auto end = at + segment.size();
+			if (segment.size() < sizeof(co_log_magic) || std::memcmp(at, co_log_magic, sizeof(co_log_magic)) != 0) {
+				throw std::runtime_error("replay_log: not a record log segment");
+			}
+			at += sizeof(co_log_magic);
+			while (static_cast<std::size_t>(end - at) >= sizeof(co_log_entry)) {
+				co_log_entry entry;
+				std::memcpy(&entry, at, sizeof(entry));
+				if (entry.stamp == 0) {
+					break;
+				}
+				at += sizeof(co_log_entry);
+				if (static_cast<std::size_t>(end - at) < entry.size) {
+					throw std::runtime_error("replay_log: truncated record");
+				}
+				if (first == 0) {
+					first = entry.stamp;
+				}
+				if (timer) {
+					auto offset = std::chrono::nanoseconds(static_cast<std::int64_t>(static_cast<double>(entry.stamp - first) / speed));
+					auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+					if (due > std::chrono::steady_clock::now()) {
+						co_await timer->at(due);
+					}
+				}
+				co_yield serializer.read(std::span<const std::byte>(reinterpret_cast<const std::byte*>(at), entry.size));
+				at += (entry.size + 7) & ~std::size_t(7);
+			}
+		}
+	}
+
+	template<typename T>
+	co_value_generator<T> replay_log(std::string path, co_reactor& reactor, double speed = 1.0) {
+		return replay_log<T>(std::move(path), std::addressof(reactor), speed);
+	}
+
+	template<typename T>
+	co_value_generator<T> replay_log(std::string path) {
+		return replay_log<T>(std::move(path), nullptr, 0.0);
+	}
+
+	// pins the calling thread to the index-th cpu it is allowed to run on,
+	// false when the affinity cannot be read or set
+	inline bool co_pin_thread(std::size_t index) {
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+			return false;
+		}
+		auto target = index % static_cast<std::size_t>(CPU_COUNT(&allowed));
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+				cpu_set_t one;
+				CPU_ZERO(&one);
+				CPU_SET(cpu, &one);
+				return ::pthread_setaffinity_np(::pthread_self(), sizeof(one), &one) == 0;
+			}
+		}
+		return false;
+	}
+
+	template<typename T, typename R>
+	struct partition_state;
+
+	// one shard of partition. the sub-pipeline is built and driven on the
+	// worker thread, between the input and output queues. the thread
+	// sleeps on events while neither of its coroutines can make progress.
+	template<typename T, typename R>
+	struct partition_worker
+	{
+		struct park_awaiter
+		{
+			coroutine_handle<>* slot;
+
+			bool await_ready() {
+				return false;
+			}
+			void await_suspend(coroutine_handle<> handle) {
+				*slot = handle;
+			}
+			void await_resume() {
+			}
+		};
+
+		explicit partition_worker(std::size_t queue) : in(queue), out(queue) {}
+
+		park_awaiter wait_input() {
+			return park_awaiter{std::addressof(reader)};
+		}
+		park_awaiter wait_output() {
+			return park_awaiter{std::addressof(writer)};
+		}
+
+		// called by the other side after it changed a queue or a flag
+		void signal() {
+			events.fetch_add(1, std::memory_order_release);
+			events.notify_one();
+		}
+
+		void run(partition_state<T, R>& state) {
+			while (!done.load(std::memory_order_acquire)) {
+				auto seen = events.load(std::memory_order_acquire);
+				auto canceled = state.canceled.load(std::memory_order_acquire);
+				bool resumed = false;
+				if (reader && (!in.empty() || closed.load(std::memory_order_acquire) || canceled)) {
+					auto h = std::exchange(reader, nullptr);
+					h();
+					resumed = true;
+				}
+				if (writer && (!out.full() || canceled)) {
+					auto h = std::exchange(writer, nullptr);
+					h();
+					resumed = true;
+				}
+				if (!resumed && canceled) {
+					// the sub-pipeline waits on an event of its own. it sees
+					// canceled on the thread that resumes it and finishes there.
+					break;
+				}
+				if (!resumed && !done.load(std::memory_order_acquire)) {
+					events.wait(seen, std::memory_order_acquire);
+				}
+			}
+		}
+
+		co_spsc_queue<T> in;
+		co_spsc_queue<R> out;
+		std::atomic<std::uint32_t> events{0};
+		// no more input will be pushed
+		std::atomic<bool> closed{false};
+		// the sub-pipeline has completed
+		std::atomic<bool> done{false};
+		std::exception_ptr error;
+		std::thread thread;
+		// owned by the worker thread
+		coroutine_handle<> reader;
+		coroutine_handle<> writer;
+		// owned by the partition coroutine, set once it has seen done
+		bool reported = false;
+	};
+
+	template<typename T, typename R>
+	struct partition_state : std::enable_shared_from_this<partition_state<T, R>>
+	{
+		using worker = partition_worker<T, R>;
+
+		// the partition coroutine waits here until a worker has output, has
+		// room for the value that is held back, or has finished
+		struct wait_awaiter
+		{
+			std::shared_ptr<partition_state> that;
+			std::size_t target;
+			bool holding;
+			std::uint64_t seen = 0;
+
+			bool await_ready() {
+				seen = that->changes.load(std::memory_order_seq_cst);
+				return that->ready(target, holding);
+			}
+			bool await_suspend(coroutine_handle<> handle) {
+				// once the handle is published a worker may resume the
+				// coroutine and destroy this awaiter, or complete it and
+				// release the state
+				auto state = that;
+				auto before = seen;
+				state->waiter.store(handle.address(), std::memory_order_seq_cst);
+				if (state->changes.load(std::memory_order_seq_cst) != before) {
+					// a worker changed something before it could see the
+					// waiter. nullptr means a worker took the handle and
+					// resumes it.
+					return state->waiter.exchange(nullptr) == nullptr;
+				}
+				return true;
+			}
+			void await_resume() {
+			}
+		};
+
+		partition_state(std::size_t n, std::size_t queue) {
+			for (std::size_t i = 0; i < n; ++i) {
+				workers.push_back(std::make_unique<worker>(queue));
+			}
+		}
+
+		// resumes the partition coroutine on this thread when it is waiting
+		void notify() {
+			changes.fetch_add(1, std::memory_order_seq_cst);
+			if (waiter.load(std::memory_order_seq_cst) == nullptr) {
+				return;
+			}
+			if (auto w = waiter.exchange(nullptr)) {
+				coroutine_handle<>::from_address(w).resume();
+			}
+		}
+
+		bool ready(std::size_t target, bool holding) {
+			for (auto& w : workers) {
+				if (!w->out.empty() || (!w->reported && w->done.load(std::memory_order_acquire))) {
+					return true;
+				}
+			}
+			return holding && (!workers[target]->in.full() || workers[target]->done.load(std::memory_order_acquire));
+		}
+
+		wait_awaiter wait(std::size_t target, bool holding) {
+			return wait_awaiter{this->shared_from_this(), target, holding};
+		}
+
+		// false when the queue of the target worker is full. values routed to
+		// a sub-pipeline that has completed are dropped.
+		bool push(std::size_t target, T& v) {
+			auto& w = *workers[target];
+			if (w.done.load(std::memory_order_acquire)) {
+				return true;
+			}
+			if (!w.in.push(std::move(v))) {
+				return false;
+			}
+			w.signal();
+			return true;
+		}
+
+		// the next output, taking the workers in turn
+		std::optional<R> pop(std::size_t& turn) {
+			for (std::size_t k = 0; k < workers.size(); ++k) {
+				auto& w = *workers[(turn + k) % workers.size()];
+				if (auto r = w.out.pop()) {
+					w.signal();
+					turn = (turn + k + 1) % workers.size();
+					return r;
+				}
+			}
+			return std::nullopt;
+		}
+
+		// true when every worker has completed and its output was taken.
+		// rethrows the error of a sub-pipeline once its output is taken.
+		bool completed() {
+			bool all = true;
+			for (auto& w : workers) {
+				if (!w->done.load(std::memory_order_acquire) || !w->out.empty()) {
+					all = false;
+					continue;
+				}
+				w->reported = true;
+				if (w->error) {
+					std::rethrow_exception(std::exchange(w->error, nullptr));
+				}
+			}
+			return all;
+		}
+
+		void close() {
+			for (auto& w : workers) {
+				w->closed.store(true, std::memory_order_release);
+				w->signal();
+			}
+		}
+
+		// stops the workers and waits for their threads. a worker resumes the
+		// lanes parked on its queues and returns, so it is not held up by a
+		// sub-pipeline that waits on something else. a worker that is running
+		// this (it resumed the partition coroutine) finishes on its own.
+		void stop() {
+			canceled.store(true, std::memory_order_release);
+			waiter.store(nullptr);
+			for (auto& w : workers) {
+				w->signal();
+			}
+			for (auto& w : workers) {
+				if (w->thread.get_id() == std::this_thread::get_id()) {
+					w->thread.detach();
+				}
+				else if (w->thread.joinable()) {
+					w->thread.join();
+				}
+			}
+		}
+
+		std::vector<std::unique_ptr<worker>> workers;
+		std::atomic<void*> waiter{nullptr};
+		// counts the notifications from the workers
+		std::atomic<std::uint64_t> changes{0};
+		std::atomic<bool> canceled{false};
+	};
+
+	template<typename T, typename R>
+	co_value_generator<T> partition_input(std::shared_ptr<partition_state<T, R>> state, partition_worker<T, R>& w) {
+		for (;;) {
+			if (auto v = w.in.pop()) {
+				// there is room in the queue again
+				state->notify();
+				co_yield *v;
+			}
+			else if (state->canceled.load(std::memory_order_acquire)) {
+				break;
+			}
+			else if (w.closed.load(std::memory_order_acquire)) {
+				// a push that came before the close is visible now
+				if (w.in.empty()) {
+					break;
+				}
+			}
+			else {
+				co_await w.wait_input();
+			}
+		}
+	}
+
+	template<typename T, typename R, typename Factory>
+	co_detached partition_output(std::shared_ptr<partition_state<T, R>> state, partition_worker<T, R>& w, Factory& factory) {
+		try
+		{
+			// the sub-pipeline frames are allocated by the worker thread
+			auto pipeline = factory(partition_input(state, w));
+			auto it = co_await pipeline.begin();
+			while (it != pipeline.end() && !state->canceled.load(std::memory_order_acquire)) {
+				R r = *it;
+				while (!w.out.push(std::move(r)) && !state->canceled.load(std::memory_order_acquire)) {
+					co_await w.wait_output();
+				}
+				state->notify();
+				co_await ++it;
+			}
+		}
+		catch (...)
+		{
+			w.error = std::current_exception();
+		}
+		w.done.store(true, std::memory_order_release);
+		// the pipeline may have been resumed off the worker thread
+		w.signal();
+		state->notify();
+	}
+
+	// cancels the workers when partition completes or is destroyed
+	template<typename T, typename R>
+	struct partition_stopper
+	{
+		std::shared_ptr<partition_state<T, R>> state;
+		~partition_stopper() {
+			state->stop();
+		}
+	};
+
+	// routes each value to one of n sub-pipelines by key_hash and merges
+	// their output. factory(input) builds a sub-pipeline from a generator of
+	// its values. each sub-pipeline runs on its own worker thread, pinned to
+	// a cpu, and is connected by bounded spsc queues of queue values. the
+	// values of one key go to the same worker, so their order is kept when
+	// the sub-pipeline keeps order. the order between keys is not kept.
+	// partition is resumed by the worker that has output when it waits, so
+	// the consumer continues on whichever worker thread pushed last, not on
+	// the thread that started it.
+	template<typename Source, typename KeyHash, typename Factory, typename SourceValue = typename std::decay_t<Source>::value_type,
+		typename Pipeline = std::invoke_result_t<Factory&, co_value_generator<SourceValue>>, typename Result = typename Pipeline::value_type>
+	co_value_generator<Result> partition(Source source, std::size_t n, KeyHash key_hash, Factory factory, std::size_t queue) {
+		using state_type = partition_state<SourceValue, Result>;
+		n = std::max<std::size_t>(n, 1);
+		auto state = std::make_shared<state_type>(n, queue);
+		partition_stopper<SourceValue, Result> stopper{state};
+		for (std::size_t i = 0; i < n; ++i) {
+			auto& w = *state->workers[i];
+			w.thread = std::thread([state, &w, i, factory]() mutable {
+				co_pin_thread(i);
+				partition_output(state, w, factory);
+				w.run(*state);
+			});
+		}
+
+		std::optional<SourceValue> held;
+		std::size_t target = 0;
+		std::size_t turn = 0;
+		bool closed = false;
+		auto it = co_await source.begin();
+		for (;;) {
+			if (auto r = state->pop(turn)) {
+				co_yield *r;
+				continue;
+			}
+			if (held && state->push(target, *held)) {
+				held.reset();
+			}
+			if (!held && it != source.end()) {
+				held.emplace(*it);
+				// fibonacci hashing spreads hashes that are the identity for integers
+				auto h = static_cast<std::uint64_t>(key_hash(std::cref(*held).get())) * 0x9E3779B97F4A7C15ull;
+				target = static_cast<std::size_t>((h >> 32) % n);
+				co_await ++it;
+				continue;
+			}
+			if (!closed && it == source.end()) {
+				closed = true;
+				state->close();
+			}
+			if (!held && state->completed()) {
+				break;
+			}
+			co_await state->wait(target, !!held);
+		}
+	}
+
+	template<typename KeyHash, typename Factory>
+	auto partition(std::size_t n, KeyHash key_hash, Factory factory, std::size_t queue = 1024) {
+		return make_operator([=](auto&& source) {
+			return partition(std::forward<decltype(source)>(source), n, key_hash, factory, queue);
+		});
+	}
+
+}
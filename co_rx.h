@@ -0,0 +1,326 @@
+#pragma once
+
+// bridges between rxcpp observables and co_alg generators. the rxcpp
+// headers come from the ext/rxcpp submodule, add ext/rxcpp/Rx/v2/src to
+// the include path.
+
+#include "co_algorithm.h"
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include "rxcpp/rx.hpp"
+
+namespace co_alg {
+
+	// what from_observable does when the observable emits while capacity
+	// values are waiting for the consumer. block stalls the emitting
+	// thread until there is room, so it needs an observable that emits on
+	// another thread than the consumer, for example with subscribe_on.
+	// drop discards the value and fail ends the generator with an error.
+	struct buffer_policy
+	{
+		enum overflow_action
+		{
+			block,
+			drop,
+			fail
+		};
+
+		std::size_t capacity = 1024;
+		overflow_action overflow = block;
+	};
+
+	// the handoff between the observer, which pushes on whatever thread
+	// the observable emits on, and the generator, which pops. the generator
+	// is resumed by the observer when it waits on an empty queue.
+	template<typename T>
+	struct observable_state
+	{
+		// the generator waits here until the queue has a value or the
+		// observable has ended
+		struct wait_awaiter
+		{
+			std::shared_ptr<observable_state> that;
+			std::uint64_t seen = 0;
+
+			bool await_ready() {
+				seen = that->changes.load(std::memory_order_seq_cst);
+				return that->ready();
+			}
+			bool await_suspend(coroutine_handle<> handle) {
+				// once the handle is published the observer may resume the
+				// generator and destroy this awaiter
+				auto state = that;
+				auto before = seen;
+				state->waiter.store(handle.address(), std::memory_order_seq_cst);
+				if (state->changes.load(std::memory_order_seq_cst) != before) {
+					// nullptr means the observer took the handle and resumes it
+					return state->waiter.exchange(nullptr) == nullptr;
+				}
+				return true;
+			}
+			void await_resume() {
+			}
+		};
+
+		explicit observable_state(buffer_policy p) : policy(p), queue(p.capacity) {}
+
+		wait_awaiter wait(std::shared_ptr<observable_state> self) {
+			return wait_awaiter{std::move(self)};
+		}
+
+		bool ready() {
+			return !queue.empty() || completed.load(std::memory_order_acquire);
+		}
+
+		// resumes the generator on this thread when it is waiting. after
+		// cancel the generator may be gone and is not resumed. a notify is
+		// counted in notifying from before it checks canceled until it has
+		// returned, cancel waits for it so that a notify that took the
+		// handle cannot resume it while the generator is destroyed.
+		void notify() {
+			notifier.store(std::this_thread::get_id(), std::memory_order_seq_cst);
+			notifying.fetch_add(1, std::memory_order_seq_cst);
+			if (!canceled.load(std::memory_order_seq_cst)) {
+				changes.fetch_add(1, std::memory_order_seq_cst);
+				if (waiter.load(std::memory_order_seq_cst) != nullptr) {
+					auto w = waiter.exchange(nullptr);
+					// cancel may have started after the first check
+					if (w && !canceled.load(std::memory_order_seq_cst)) {
+						coroutine_handle<>::from_address(w).resume();
+					}
+				}
+			}
+			notifying.fetch_sub(1, std::memory_order_seq_cst);
+		}
+
+		// observer
+		void on_next(T v) {
+			if (completed.load(std::memory_order_acquire) || canceled.load(std::memory_order_acquire)) {
+				return;
+			}
+			if (!queue.push(std::move(v))) {
+				if (policy.overflow == buffer_policy::drop) {
+					return;
+				}
+				if (policy.overflow == buffer_policy::block) {
+					if (subscribing.load(std::memory_order_acquire) && std::this_thread::get_id() == subscriber) {
+						fail(std::make_exception_ptr(std::logic_error("from_observable: the observable emits on the consuming thread, block needs subscribe_on or a larger capacity")));
+						return;
+					}
+					blocked.store(true, std::memory_order_seq_cst);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					for (;;) {
+						auto seen = freed.load(std::memory_order_acquire);
+						if (queue.push(std::move(v)) || canceled.load(std::memory_order_acquire)) {
+							break;
+						}
+						freed.wait(seen, std::memory_order_acquire);
+					}
+					blocked.store(false, std::memory_order_relaxed);
+				}
+				else {
+					fail(std::make_exception_ptr(std::overflow_error("from_observable: the buffer is full")));
+					return;
+				}
+			}
+			notify();
+		}
+
+		void on_error(std::exception_ptr e) {
+			fail(e);
+		}
+
+		void on_completed() {
+			if (canceled.load(std::memory_order_acquire)) {
+				return;
+			}
+			completed.store(true, std::memory_order_release);
+			notify();
+		}
+
+		void fail(std::exception_ptr e) {
+			if (completed.load(std::memory_order_acquire) || canceled.load(std::memory_order_acquire)) {
+				return;
+			}
+			// published by the release store of completed
+			error = e;
+			completed.store(true, std::memory_order_release);
+			lifetime.unsubscribe();
+			notify();
+		}
+
+		// generator
+		std::optional<T> pop() {
+			auto v = queue.pop();
+			if (v && policy.overflow == buffer_policy::block) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (blocked.load(std::memory_order_relaxed)) {
+					wake();
+				}
+			}
+			return v;
+		}
+
+		void wake() {
+			freed.fetch_add(1, std::memory_order_release);
+			freed.notify_one();
+		}
+
+		// called when the generator is destroyed, the observer must not
+		// resume it any more. a notify in flight on another thread is
+		// waited for. on the notifying thread the generator is destroyed
+		// from inside the resume, that notify is done with it.
+		void cancel() {
+			canceled.store(true, std::memory_order_seq_cst);
+			waiter.exchange(nullptr);
+			auto self = std::this_thread::get_id();
+			while (notifying.load(std::memory_order_seq_cst) != 0 && notifier.load(std::memory_order_seq_cst) != self) {
+				std::this_thread::yield();
+			}
+			lifetime.unsubscribe();
+			wake();
+		}
+
+		buffer_policy policy;
+		co_spsc_queue<T> queue;
+		rxcpp::composite_subscription lifetime;
+		std::atomic<std::uint64_t> changes{0};
+		std::atomic<void*> waiter{nullptr};
+		// notifies in flight and the thread of the last one, the
+		// observable does not emit concurrently
+		std::atomic<std::uint32_t> notifying{0};
+		std::atomic<std::thread::id> notifier;
+		std::atomic<bool> completed{false};
+		std::atomic<bool> canceled{false};
+		// the observer waits on freed while blocked is set
+		std::atomic<bool> blocked{false};
+		std::atomic<std::uint32_t> freed{0};
+		// set while subscribe runs on the subscriber thread
+		std::atomic<bool> subscribing{false};
+		std::thread::id subscriber;
+		std::exception_ptr error;
+	};
+
+	template<typename T>
+	struct observable_canceler
+	{
+		~observable_canceler() {
+			state->cancel();
+		}
+
+		std::shared_ptr<observable_state<T>> state;
+	};
+
+	// a generator of the values of an observable. the observable is
+	// subscribed when the generator starts and unsubscribed when it is
+	// destroyed. values are handed over through a single producer single
+	// consumer queue, the observer resumes the generator only when it has
+	// drained the queue, so a burst is consumed with one wakeup. the
+	// observable must not emit concurrently, which rxcpp guarantees.
+	template<typename Observable, typename T = typename std::decay_t<Observable>::value_type>
+	co_value_generator<T> from_observable(Observable observable, buffer_policy policy) {
+		auto state = std::make_shared<observable_state<T>>(policy);
+		observable_canceler<T> canceler{state};
+		state->subscriber = std::this_thread::get_id();
+		state->subscribing.store(true, std::memory_order_release);
+		observable.subscribe(
+			state->lifetime,
+			[state](T v) { state->on_next(std::move(v)); },
+			[state](std::exception_ptr e) { state->on_error(e); },
+			[state]() { state->on_completed(); });
+		state->subscribing.store(false, std::memory_order_release);
+		for (;;) {
+			while (auto v = state->pop()) {
+				co_yield *v;
+			}
+			if (state->completed.load(std::memory_order_acquire)) {
+				// values pushed before completed are in the queue
+				if (!state->queue.empty()) {
+					continue;
+				}
+				if (state->error) {
+					std::rethrow_exception(state->error);
+				}
+				break;
+			}
+			co_await state->wait(state);
+		}
+	}
+
+	template<typename Observable>
+	auto from_observable(Observable observable) {
+		return from_observable(std::move(observable), buffer_policy{});
+	}
+
+	template<typename Source, typename Subscriber>
+	co_detached to_observable_run(Source source, Subscriber subscriber) {
+		try
+		{
+			auto it = co_await source.begin();
+			while (it != source.end()) {
+				if (!subscriber.is_subscribed()) {
+					co_return;
+				}
+				subscriber.on_next(*it);
+				co_await ++it;
+			}
+		}
+		catch (...)
+		{
+			if (subscriber.is_subscribed()) {
+				subscriber.on_error(std::current_exception());
+			}
+			co_return;
+		}
+		if (subscriber.is_subscribed()) {
+			subscriber.on_completed();
+		}
+	}
+
+	template<typename Source>
+	struct observable_source
+	{
+		explicit observable_source(Source s) : source(std::move(s)) {}
+
+		std::atomic<bool> taken{false};
+		Source source;
+	};
+
+	// an observable of the values of a generator. on_next is called
+	// directly on the thread that resumes the generator, there is no queue,
+	// and the next value is pulled only after on_next returns, so a slow
+	// observer slows the generator down. a generator is walked once, so
+	// only the first subscription receives values, later ones get an error.
+	// unsubscribing stops the walk at the next value.
+	template<typename Source, typename T = typename std::decay_t<Source>::value_type>
+	rxcpp::observable<T> to_observable(Source source) {
+		auto shared = std::make_shared<observable_source<Source>>(std::move(source));
+		return rxcpp::observable<>::create<T>([shared](rxcpp::subscriber<T> subscriber) {
+			if (shared->taken.exchange(true)) {
+				subscriber.on_error(std::make_exception_ptr(std::logic_error("to_observable: the generator has already been subscribed")));
+				return;
+			}
+			to_observable_run(std::move(shared->source), std::move(subscriber));
+		}).as_dynamic();
+	}
+
+	inline auto from_observable(buffer_policy policy) {
+		return make_operator([=](auto&& observable) {
+			return from_observable(std::forward<decltype(observable)>(observable), policy);
+		});
+	}
+
+	inline auto to_observable() {
+		return make_operator([=](auto&& source) {
+			return to_observable(std::forward<decltype(source)>(source));
+		});
+	}
+
+}
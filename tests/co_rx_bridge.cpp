@@ -0,0 +1,116 @@
+// from_observable against rxcpp, one case per overflow policy and one
+// that destroys the generator while the observable is still emitting.
+//   g++ -std=c++20 -pthread -I.. -I../ext/rxcpp/Rx/v2/src co_rx_bridge.cpp
+
+#include "co_rx.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace co_alg;
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const char* what) {
+		if (!condition) {
+			++failures;
+			std::fprintf(stderr, "failed: %s\n", what);
+		}
+	}
+
+	// emits 0 to count - 1 on the subscribing thread
+	rxcpp::observable<int> numbers(int count) {
+		return rxcpp::observable<>::create<int>([count](rxcpp::subscriber<int> s) {
+			for (int i = 0; i < count && s.is_subscribed(); ++i) {
+				s.on_next(i);
+			}
+			s.on_completed();
+		}).as_dynamic();
+	}
+
+	// emits 0 to count - 1 on a thread of its own, sets stopped when it is done
+	rxcpp::observable<int> numbers_on_thread(int count, std::atomic<int>* emitted, std::atomic<bool>* stopped) {
+		return rxcpp::observable<>::create<int>([=](rxcpp::subscriber<int> s) {
+			std::thread([=]() {
+				for (int i = 0; i < count && s.is_subscribed(); ++i) {
+					s.on_next(i);
+					emitted->fetch_add(1);
+				}
+				s.on_completed();
+				stopped->store(true);
+			}).detach();
+		}).as_dynamic();
+	}
+
+	void wait_for(std::atomic<bool>& flag) {
+		auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (!flag.load() && std::chrono::steady_clock::now() < until) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+}
+
+int main() {
+	{
+		// block stalls the emitting thread, nothing is lost
+		std::atomic<int> emitted{0};
+		std::atomic<bool> stopped{false};
+		auto v = sync_wait(from_observable(numbers_on_thread(100000, &emitted, &stopped), buffer_policy{16, buffer_policy::block}) | to_vector());
+		bool ordered = v.size() == 100000;
+		for (std::size_t i = 0; ordered && i < v.size(); ++i) {
+			ordered = v[i] == static_cast<int>(i);
+		}
+		check(ordered, "block delivers every value in order");
+		wait_for(stopped);
+	}
+	{
+		// the consumer waits until subscribe returns, so the rest is dropped
+		auto v = sync_wait(from_observable(numbers(100), buffer_policy{8, buffer_policy::drop}) | to_vector());
+		check(v.size() == 8 && v.front() == 0 && v.back() == 7, "drop keeps the values that fit");
+	}
+	{
+		bool overflowed = false;
+		try
+		{
+			sync_wait(numbers(100) | from_observable(buffer_policy{8, buffer_policy::fail}) | to_vector());
+		}
+		catch (std::overflow_error&)
+		{
+			overflowed = true;
+		}
+		check(overflowed, "fail ends the generator with overflow_error");
+	}
+	{
+		// block on the consuming thread would never be drained
+		bool rejected = false;
+		try
+		{
+			sync_wait(from_observable(numbers(100), buffer_policy{8, buffer_policy::block}) | to_vector());
+		}
+		catch (std::logic_error&)
+		{
+			rejected = true;
+		}
+		check(rejected, "block rejects an observable that emits on the consuming thread");
+	}
+	{
+		// the generator is destroyed after its first value while the
+		// emitting thread is blocked on a full buffer
+		std::atomic<int> emitted{0};
+		std::atomic<bool> stopped{false};
+		auto first_value = sync_wait(from_observable(numbers_on_thread(1000000, &emitted, &stopped), buffer_policy{4, buffer_policy::block}) | first());
+		check(first_value && *first_value == 0, "the first value arrives");
+		wait_for(stopped);
+		check(stopped.load(), "the observable sees the unsubscribe and stops");
+		check(emitted.load() < 1000000, "the observable stops early");
+	}
+	std::printf("%s\n", failures ? "failed" : "ok");
+	return failures != 0;
+}
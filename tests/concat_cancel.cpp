@@ -0,0 +1,129 @@
+// destroys a concat pipeline while it waits on a prefetched inner stream.
+// build with -fsanitize=address to catch a resume of the destroyed frame.
+//   g++ -std=c++20 -fsanitize=address -I.. concat_cancel.cpp
+
+#include "co_algorithm.h"
+
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <vector>
+
+using namespace co_alg;
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const char* what) {
+		if (!condition) {
+			++failures;
+			std::fprintf(stderr, "failed: %s\n", what);
+		}
+	}
+
+	// stands in for an event loop, the inner streams park here
+	std::deque<coroutine_handle<>> parked;
+
+	struct park_awaiter
+	{
+		bool await_ready() {
+			return false;
+		}
+		void await_suspend(coroutine_handle<> handle) {
+			parked.push_back(handle);
+		}
+		void await_resume() {
+		}
+	};
+
+	void run() {
+		while (!parked.empty()) {
+			auto h = parked.front();
+			parked.pop_front();
+			h();
+		}
+	}
+
+	int pulled = 0;
+
+	co_value_generator<int> shard(int id, int count) {
+		for (int i = 0; i < count; ++i) {
+			co_await park_awaiter{};
+			++pulled;
+			co_yield id * 100 + i;
+		}
+	}
+
+	co_value_generator<co_value_generator<int>> shards(int count, int values) {
+		for (int i = 0; i < count; ++i) {
+			co_yield shard(i, values);
+		}
+	}
+
+	// a consumer that the test destroys while it is suspended
+	struct consumer
+	{
+		struct promise_type
+		{
+			consumer get_return_object() {
+				return consumer{coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			suspend_never initial_suspend() noexcept {
+				return {};
+			}
+			suspend_always final_suspend() noexcept {
+				return {};
+			}
+			void return_void() {
+			}
+			void unhandled_exception() {
+				std::terminate();
+			}
+		};
+
+		~consumer() {
+			handle.destroy();
+		}
+
+		coroutine_handle<promise_type> handle;
+	};
+
+	// pulls one value, then stays suspended in concat
+	consumer first_value(co_value_generator<int>& pipeline, std::vector<int>& out) {
+		auto it = co_await pipeline.begin();
+		if (it != pipeline.end()) {
+			out.push_back(*it);
+			co_await ++it;
+			out.push_back(-1);
+		}
+	}
+
+}
+
+int main() {
+	{
+		std::vector<int> out;
+		{
+			// the buffer outlasts the shards, so concat takes every value
+			// from the prefetcher and waits on it instead of the shard
+			auto pipeline = shards(3, 4) | concat(2, 8);
+			auto reader = first_value(pipeline, out);
+			while (out.empty() && !parked.empty()) {
+				auto h = parked.front();
+				parked.pop_front();
+				h();
+			}
+			check(out.size() == 1 && out[0] == 0, "the first value arrives");
+			// concat waits on the first shard, the prefetchers are parked too
+			check(!parked.empty(), "the shards are parked");
+		}
+		auto before = pulled;
+		run();
+		check(out.size() == 1, "the destroyed pipeline is not resumed");
+		// each parked shard yields at most the value it was producing
+		check(pulled - before <= 3, "the prefetchers stop pulling");
+	}
+	std::printf("%s\n", failures ? "failed" : "ok");
+	return failures != 0;
+}
@@ -0,0 +1,184 @@
+// destroys group_by readers while they wait for the shared source.
+// build with -fsanitize=address to catch a resume of a destroyed frame.
+//   g++ -std=c++20 -fsanitize=address -I.. group_by_cancel.cpp
+
+#include "co_algorithm.h"
+
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <vector>
+
+using namespace co_alg;
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const char* what) {
+		if (!condition) {
+			++failures;
+			std::fprintf(stderr, "failed: %s\n", what);
+		}
+	}
+
+	// stands in for an event loop, the inner streams park here
+	std::deque<coroutine_handle<>> parked;
+
+	struct park_awaiter
+	{
+		bool await_ready() {
+			return false;
+		}
+		void await_suspend(coroutine_handle<> handle) {
+			parked.push_back(handle);
+		}
+		void await_resume() {
+		}
+	};
+
+	void run() {
+		while (!parked.empty()) {
+			auto h = parked.front();
+			parked.pop_front();
+			h();
+		}
+	}
+
+	// each value arrives from the loop
+	co_value_generator<int> ticks(int count) {
+		for (int i = 0; i < count; ++i) {
+			co_await park_awaiter{};
+			co_yield i;
+		}
+	}
+
+	// a consumer that the test destroys while it is suspended
+	struct consumer
+	{
+		struct promise_type
+		{
+			consumer get_return_object() {
+				return consumer{coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			suspend_never initial_suspend() noexcept {
+				return {};
+			}
+			suspend_always final_suspend() noexcept {
+				return {};
+			}
+			void return_void() {
+			}
+			void unhandled_exception() {
+				std::terminate();
+			}
+		};
+
+		~consumer() {
+			handle.destroy();
+		}
+
+		coroutine_handle<promise_type> handle;
+	};
+
+	// reads every value of a stream until it ends or is destroyed
+	consumer read_all(co_value_generator<int>& values, std::vector<int>& out) {
+		auto it = co_await values.begin();
+		while (it != values.end()) {
+			out.push_back(*it);
+			co_await ++it;
+		}
+		out.push_back(-1);
+	}
+
+	// keeps every group of a group_by
+	template<typename Groups, typename Group>
+	consumer read_groups(Groups& groups, std::vector<Group>& out) {
+		auto it = co_await groups.begin();
+		while (it != groups.end()) {
+			out.push_back(*it);
+			co_await ++it;
+		}
+	}
+
+	auto parity(int count) {
+		return ticks(count) | group_by([](int v) { return v % 2; });
+	}
+
+	// steps the loop until out holds count values
+	template<typename T>
+	void run_until(std::vector<T> const & out, std::size_t count) {
+		while (out.size() < count && !parked.empty()) {
+			auto h = parked.front();
+			parked.pop_front();
+			h();
+		}
+	}
+
+}
+
+int main() {
+	{
+		// one group is dropped mid-stream while the other keeps reading
+		auto groups = parity(8);
+		std::vector<decltype(groups)::value_type> gs;
+		auto groups_reader = read_groups(groups, gs);
+		run_until(gs, 2);
+		check(gs.size() == 2, "both groups are emitted");
+		std::vector<int> even_out;
+		std::vector<int> odd_out;
+		auto even = gs[0].values();
+		auto even_reader = read_all(even, even_out);
+		{
+			auto odd = gs[1].values();
+			auto odd_reader = read_all(odd, odd_out);
+			run_until(odd_out, 2);
+			check(odd_out.size() == 2, "the odd group is read");
+		}
+		gs.pop_back();
+		run();
+		check(odd_out.size() == 2, "the dropped group is not resumed");
+		check((even_out == std::vector<int>{0, 2, 4, 6, -1}), "the other group gets every value");
+	}
+	{
+		// the stream of groups is dropped, then the only reader is dropped
+		// while the source produces its value, a later reader still gets
+		// every value
+		std::vector<decltype(parity(0))::value_type> gs;
+		{
+			auto groups = parity(6);
+			auto groups_reader = read_groups(groups, gs);
+			run_until(gs, 1);
+		}
+		std::vector<int> a_out;
+		{
+			auto a = gs[0].values();
+			auto a_reader = read_all(a, a_out);
+			check(!parked.empty(), "the source is pulled");
+		}
+		run();
+		check(a_out.size() == 1, "the dropped reader is not resumed");
+		std::vector<int> b_out;
+		auto b = gs[0].values();
+		auto b_reader = read_all(b, b_out);
+		run();
+		check((b_out == std::vector<int>{2, 4, -1}), "a later reader takes over the source");
+	}
+	{
+		// everything is destroyed while the source produces a value
+		std::vector<int> a_out;
+		{
+			auto groups = parity(4);
+			std::vector<decltype(groups)::value_type> gs;
+			auto groups_reader = read_groups(groups, gs);
+			run_until(gs, 1);
+			auto a = gs[0].values();
+			auto a_reader = read_all(a, a_out);
+		}
+		run();
+		check(a_out.size() == 1, "nothing is resumed after the group_by is gone");
+	}
+	std::printf("%s\n", failures ? "failed" : "ok");
+	return failures != 0;
+}
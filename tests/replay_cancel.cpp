@@ -0,0 +1,155 @@
+// destroys replay subscribers while they wait for the shared source.
+// build with -fsanitize=address to catch a resume of a destroyed frame.
+//   g++ -std=c++20 -fsanitize=address -I.. replay_cancel.cpp
+
+#include "co_algorithm.h"
+
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <vector>
+
+using namespace co_alg;
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const char* what) {
+		if (!condition) {
+			++failures;
+			std::fprintf(stderr, "failed: %s\n", what);
+		}
+	}
+
+	// stands in for an event loop, the inner streams park here
+	std::deque<coroutine_handle<>> parked;
+
+	struct park_awaiter
+	{
+		bool await_ready() {
+			return false;
+		}
+		void await_suspend(coroutine_handle<> handle) {
+			parked.push_back(handle);
+		}
+		void await_resume() {
+		}
+	};
+
+	void run() {
+		while (!parked.empty()) {
+			auto h = parked.front();
+			parked.pop_front();
+			h();
+		}
+	}
+
+	// each value arrives from the loop
+	co_value_generator<int> ticks(int count) {
+		for (int i = 0; i < count; ++i) {
+			co_await park_awaiter{};
+			co_yield i;
+		}
+	}
+
+	// a consumer that the test destroys while it is suspended
+	struct consumer
+	{
+		struct promise_type
+		{
+			consumer get_return_object() {
+				return consumer{coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			suspend_never initial_suspend() noexcept {
+				return {};
+			}
+			suspend_always final_suspend() noexcept {
+				return {};
+			}
+			void return_void() {
+			}
+			void unhandled_exception() {
+				std::terminate();
+			}
+		};
+
+		~consumer() {
+			handle.destroy();
+		}
+
+		coroutine_handle<promise_type> handle;
+	};
+
+	// reads every value of a subscription until it ends or is destroyed
+	consumer read_all(co_value_generator<int>& subscription, std::vector<int>& out) {
+		auto it = co_await subscription.begin();
+		while (it != subscription.end()) {
+			out.push_back(*it);
+			co_await ++it;
+		}
+		out.push_back(-1);
+	}
+
+	// steps the loop until out holds count values
+	void run_until(std::vector<int> const & out, std::size_t count) {
+		while (out.size() < count && !parked.empty()) {
+			auto h = parked.front();
+			parked.pop_front();
+			h();
+		}
+	}
+
+}
+
+int main() {
+	{
+		// a subscriber is destroyed while it is queued for the next value
+		auto r = ticks(5) | replay(8);
+		std::vector<int> a_out;
+		std::vector<int> b_out;
+		auto b = r.subscribe();
+		auto b_reader = read_all(b, b_out);
+		{
+			auto a = r.subscribe();
+			auto a_reader = read_all(a, a_out);
+			run_until(a_out, 1);
+			check(a_out.size() == 1 && b_out.size() == 1, "both subscribers get the first value");
+		}
+		run();
+		check(a_out.size() == 1, "the destroyed subscriber is not resumed");
+		check((b_out == std::vector<int>{0, 1, 2, 3, 4, -1}), "the other subscriber gets every value");
+	}
+	{
+		// the subscriber that asked for the value is destroyed while the
+		// source produces it, a later subscriber still gets every value
+		auto r = ticks(3) | replay(8);
+		std::vector<int> a_out;
+		{
+			auto a = r.subscribe();
+			auto a_reader = read_all(a, a_out);
+			check(!parked.empty(), "the source is pulled");
+		}
+		run();
+		check(a_out.empty(), "the destroyed subscriber is not resumed");
+		std::vector<int> b_out;
+		auto b = r.subscribe();
+		auto b_reader = read_all(b, b_out);
+		run();
+		check((b_out == std::vector<int>{0, 1, 2, -1}), "a later subscriber takes over the source");
+	}
+	{
+		// everything is destroyed while the source produces a value
+		std::vector<int> a_out;
+		{
+			auto r = ticks(3) | replay(8);
+			auto a = r.subscribe();
+			auto a_reader = read_all(a, a_out);
+		}
+		run();
+		check(a_out.empty(), "nothing is resumed after the replay is gone");
+	}
+	std::printf("%s\n", failures ? "failed" : "ok");
+	return failures != 0;
+}